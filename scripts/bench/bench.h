@@ -0,0 +1,35 @@
+/*
+ * Copyright 2010, Intel Corporation
+ *
+ * This file is part of PowerTOP
+ *
+ * This program file is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; version 2 of the License.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program in a file named COPYING; if not, write to the
+ * Free Software Foundation, Inc,
+ * 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1301 USA
+ * or just google for it.
+ */
+
+#ifndef _INCLUDE_GUARD_BENCH_H
+#define _INCLUDE_GUARD_BENCH_H
+
+/*
+ * Shared by the benchmark drivers in scripts/bench. They are linked
+ * against the PowerTOP sources minus main.cpp, so bench.cpp stands in
+ * for the globals main.cpp would otherwise provide.
+ */
+
+/* CLOCK_MONOTONIC in seconds */
+extern double bench_now(void);
+
+#endif
@@ -0,0 +1,180 @@
+/*
+ * Copyright 2010, Intel Corporation
+ *
+ * This file is part of PowerTOP
+ *
+ * This program file is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; version 2 of the License.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program in a file named COPYING; if not, write to the
+ * Free Software Foundation, Inc,
+ * 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1301 USA
+ * or just google for it.
+ */
+
+
+/*
+ * Consumer sort microbenchmark.
+ *
+ * Sorts a synthetic all_power with power_cpu_sort() from do_process.cpp
+ * the way the process reports do, once with power_consumer::Witts() and
+ * its per-interval cost snapshot, and once with the Witts() it replaced,
+ * which looked every cost parameter up by name. Witts() runs twice per
+ * comparison, so those lookups (a std::string built from the name plus a
+ * param_index search) happen O(n log n) times per sort.
+ *
+ * The old Witts() is kept here as an override on top of the real
+ * power_consumer; everything else, the parameter store included, is the
+ * PowerTOP code. The parameter map holds as many names as a typical
+ * laptop registers for its devices.
+ *
+ *	cmake -DBUILD_BENCHMARKS=ON ... && make bench
+ *	./bench-consumer-sort [consumers] [sorts]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <vector>
+#include <algorithm>
+
+#include "process/powerconsumer.h"
+#include "parameters/parameters.h"
+#include "bench.h"
+
+using namespace std;
+
+class bench_consumer : public power_consumer {
+public:
+	int id;
+};
+
+/* what Witts() was before the snapshot */
+class by_name_consumer : public bench_consumer {
+public:
+	virtual double Witts(void);
+};
+
+double by_name_consumer::Witts(void)
+{
+	double cost;
+	double timecost, wakeupcost, gpucost, disk_cost, hard_disk_cost, xwake_cost;
+
+	if (child_runtime > accumulated_runtime)
+		child_runtime = 0;
+
+	timecost = get_parameter_value("cpu-consumption");
+	wakeupcost = get_parameter_value("cpu-wakeups");
+	gpucost = get_parameter_value("gpu-operations");
+	disk_cost = get_parameter_value("disk-operations");
+	hard_disk_cost = get_parameter_value("disk-operations-hard");
+	xwake_cost = get_parameter_value("xwakes");
+
+	cost = 0;
+	cost += wakeupcost * wake_ups / 10000.0;
+	cost += ( (accumulated_runtime - child_runtime) / 1000000000.0) * timecost;
+	cost += gpucost * gpu_ops / 100.0;
+	cost += hard_disk_cost * hard_disk_hits / 100.0;
+	cost += disk_cost * disk_hits / 100.0;
+	cost += xwake_cost * xwakes / 100.0;
+
+	cost = cost / measurement_time;
+	cost += power_charge;
+	return cost;
+}
+
+static void fill(class bench_consumer *consumer, int id)
+{
+	consumer->id = id;
+	/* many idle consumers tie, which exercises the fallback comparisons */
+	consumer->accumulated_runtime = (rand() % 4) ? rand() % 100000000 : 0;
+	consumer->wake_ups = rand() % 2000;
+	consumer->disk_hits = rand() % 8 ? 0 : rand() % 100;
+	consumer->gpu_ops = rand() % 16 ? 0 : rand() % 500;
+	consumer->xwakes = rand() % 32 ? 0 : rand() % 50;
+}
+
+static double run(const vector<class power_consumer *> &input, int sorts, vector<int> &order)
+{
+	vector<class power_consumer *> sorted;
+	double total = 0, start;
+	unsigned int i;
+	int s;
+
+	for (s = 0; s < sorts; s++) {
+		sorted = input;
+		start = bench_now();
+		/* once per interval, as process_process_data() does */
+		snapshot_consumer_costs();
+		sort(sorted.begin(), sorted.end(), power_cpu_sort);
+		total += bench_now() - start;
+	}
+
+	order.clear();
+	for (i = 0; i < sorted.size(); i++)
+		order.push_back(((class bench_consumer *)sorted[i])->id);
+	return total / sorts;
+}
+
+int main(int argc, char **argv)
+{
+	int consumers = argc > 1 ? atoi(argv[1]) : 10000;
+	int sorts = argc > 2 ? atoi(argv[2]) : 20;
+	vector<class power_consumer *> by_name, snapshot;
+	vector<int> by_name_order, snapshot_order;
+	double name_time, snapshot_time;
+	char name[64];
+	int i;
+
+	measurement_time = 20.0;
+
+	/* main.cpp's defaults, then the device parameters */
+	register_parameter("base power", 100, 0.5);
+	register_parameter("cpu-wakeups", 39.5);
+	register_parameter("cpu-consumption", 1.56);
+	register_parameter("gpu-operations", 0.5576);
+	register_parameter("disk-operations-hard", 0.2);
+	register_parameter("disk-operations", 0.0);
+	register_parameter("xwakes", 0.1);
+	resolve_consumer_costs();
+	for (i = 0; i < 80; i++) {
+		snprintf(name, sizeof(name), "device-parameter-%02d", i);
+		register_parameter(name, 0.5);
+	}
+
+	srand(1);
+	for (i = 0; i < consumers; i++) {
+		class bench_consumer *consumer = new class by_name_consumer;
+
+		fill(consumer, i);
+		by_name.push_back(consumer);
+	}
+	srand(1);
+	for (i = 0; i < consumers; i++) {
+		class bench_consumer *consumer = new class bench_consumer;
+
+		fill(consumer, i);
+		snapshot.push_back(consumer);
+	}
+
+	name_time = run(by_name, sorts, by_name_order);
+	snapshot_time = run(snapshot, sorts, snapshot_order);
+
+	if (by_name_order != snapshot_order) {
+		fprintf(stderr, "sort orders differ\n");
+		return 1;
+	}
+
+	printf("%i consumers, %i sorts\n", consumers, sorts);
+	printf("by name   %8.3f ms/sort\n", name_time * 1000);
+	printf("snapshot  %8.3f ms/sort\n", snapshot_time * 1000);
+	printf("speedup %.1fx\n", name_time / snapshot_time);
+	return 0;
+}
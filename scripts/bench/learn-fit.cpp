@@ -0,0 +1,205 @@
+/*
+ * Copyright 2010, Intel Corporation
+ *
+ * This file is part of PowerTOP
+ *
+ * This program file is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; version 2 of the License.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program in a file named COPYING; if not, write to the
+ * Free Software Foundation, Inc,
+ * 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1301 USA
+ * or just google for it.
+ */
+
+
+
+/*
+ * Parameter learning benchmark.
+ *
+ * Loads a saved_results.powertop file (what --calibrate and ordinary runs
+ * leave in /var/cache/powertop) with load_results(), and learns the power
+ * parameters from it twice, starting from the same values: once with
+ * fit_parameters() and once with hill_climb(), as learn_parameters() does
+ * with --debug. Reports the error of each the way --debug does (the
+ * power weighted squared error per result) along with the mean absolute
+ * error in watts, and how long each took.
+ *
+ * The devices that owned the results are not around when the file is
+ * replayed, so every result gets a linear device with a parameter of the
+ * same name, like a runtime PM device. The learning itself, the power
+ * model and the parameter store are the PowerTOP code.
+ *
+ * Without a results file at hand, --synthetic writes one from known
+ * costs and some noise.
+ *
+ *	cmake -DBUILD_BENCHMARKS=ON ... && make bench
+ *	./bench-learn-fit <saved_results.powertop> [iterations]
+ *	./bench-learn-fit --synthetic <devices> <results> <file>
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <vector>
+#include <map>
+#include <string>
+
+#include "devices/device.h"
+#include "parameters/parameters.h"
+#include "bench.h"
+
+using namespace std;
+
+class bench_device: public device {
+	int index;
+	int r_index;
+	char name[128];
+public:
+	bench_device(const char *_name);
+
+	virtual const char * class_name(void) { return "bench";};
+	virtual const char * device_name(void) { return name;};
+	virtual double power_usage(struct result_bundle *result, struct parameter_bundle *bundle);
+	virtual bool power_terms(vector<struct power_term> &terms);
+};
+
+bench_device::bench_device(const char *_name)
+{
+	snprintf(name, sizeof(name), "%s", _name);
+	register_parameter(name);
+	index = get_param_index(name);
+	r_index = get_result_index(name);
+}
+
+double bench_device::power_usage(struct result_bundle *result, struct parameter_bundle *bundle)
+{
+	return get_result_value(r_index, result) * get_parameter_value(index, bundle) / 100.0;
+}
+
+bool bench_device::power_terms(vector<struct power_term> &terms)
+{
+	struct power_term term;
+
+	term.param = index;
+	term.result = r_index;
+	term.scale = 1 / 100.0;
+	terms.push_back(term);
+	return true;
+}
+
+/* device i costs 0.5 - 20 W at 100%, and is busy in about a third of the results */
+static int synthesize(int devices, int results, const char *filename)
+{
+	vector<double> cost(devices);
+	char name[64];
+	int i, r;
+
+	srand(1);
+	for (i = 0; i < devices; i++)
+		cost[i] = 0.5 + (rand() % 1950) / 100.0;
+
+	for (r = 0; r < results; r++) {
+		struct result_bundle *bundle = new struct result_bundle;
+		double power = 0;
+
+		for (i = 0; i < devices; i++) {
+			double util = (rand() % 3) ? 0.0 : rand() % 10001 / 100.0;
+
+			snprintf(name, sizeof(name), "bench-device-%03d", i);
+			set_result_value(name, util, bundle);
+			power += cost[i] * util / 100.0;
+		}
+		/* +-2% of meter noise */
+		bundle->power = power * (0.98 + (rand() % 401) / 10000.0);
+		past_results.push_back(bundle);
+	}
+
+	save_all_results(filename);
+	printf("wrote %i results for %i devices to %s\n", results, devices, filename);
+	return 0;
+}
+
+/* mean absolute error in watts over past_results */
+static double watts_error(struct parameter_bundle *bundle)
+{
+	vector<double> power;
+	double sum = 0;
+	unsigned int r;
+
+	past_results_power(bundle, power);
+	for (r = 0; r < past_results.size(); r++)
+		sum += fabs(power[r] - past_results[r]->power);
+	return sum / past_results.size();
+}
+
+int main(int argc, char **argv)
+{
+	struct parameter_bundle start, climbed;
+	map<string, int>::iterator it;
+	double begin, fit_time, climb_time;
+	int iterations;
+	unsigned int bpi;
+	bool fitted;
+
+	if (argc > 1 && strcmp(argv[1], "--synthetic") == 0) {
+		if (argc < 5) {
+			fprintf(stderr, "usage: %s --synthetic <devices> <results> <file>\n", argv[0]);
+			return 1;
+		}
+		return synthesize(atoi(argv[2]), atoi(argv[3]), argv[4]);
+	}
+	if (argc < 2) {
+		fprintf(stderr, "usage: %s <saved_results.powertop> [iterations]\n", argv[0]);
+		return 1;
+	}
+	iterations = argc > 2 ? atoi(argv[2]) : 250;
+
+	register_parameter("base power", 100, 0.5);
+	bpi = get_param_index("base power");
+
+	load_results(argv[1]);
+	if (past_results.empty())
+		return 1;
+
+	for (it = result_index.begin(); it != result_index.end(); it++)
+		all_devices.push_back(new class bench_device(it->first.c_str()));
+
+	if (past_results.size() <= all_parameters.parameters.size())
+		fprintf(stderr, "note: %u results for %u parameters, learn_parameters() would wait for more\n",
+			(unsigned int)past_results.size(), (unsigned int)all_parameters.parameters.size());
+
+	precompute_valid();
+	start = all_parameters;
+	srand(1);
+
+	begin = bench_now();
+	fitted = fit_parameters(bpi);
+	fit_time = bench_now() - begin;
+
+	climbed = start;
+	begin = bench_now();
+	hill_climb(&climbed, iterations, 0, bpi);
+	climb_time = bench_now() - begin;
+
+	printf("%u results, %u devices, %u parameters\n", (unsigned int)past_results.size(),
+		(unsigned int)all_devices.size(), (unsigned int)all_parameters.parameters.size());
+	printf("start         error %12.2f  %7.3f W\n",
+		calculate_params(&start) / past_results.size(), watts_error(&start));
+	printf("hill climber  error %12.2f  %7.3f W  %10.2f ms (%i iterations)\n",
+		calculate_params(&climbed) / past_results.size(), watts_error(&climbed),
+		climb_time * 1000, iterations);
+	printf("NNLS fit      error %12.2f  %7.3f W  %10.2f ms%s\n",
+		calculate_params(&all_parameters) / past_results.size(), watts_error(&all_parameters),
+		fit_time * 1000, fitted ? "" : " (not taken)");
+	return 0;
+}
@@ -0,0 +1,222 @@
+/*
+ * Copyright 2010, Intel Corporation
+ *
+ * This file is part of PowerTOP
+ *
+ * This program file is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; version 2 of the License.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program in a file named COPYING; if not, write to the
+ * Free Software Foundation, Inc,
+ * 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1301 USA
+ * or just google for it.
+ */
+
+
+
+/*
+ * merge_processes() check.
+ *
+ * Feeds random process lists through merge_processes() and through the
+ * pairwise merge it replaced, and fails unless both leave the same
+ * survivors in the same order with the same totals. The totals are
+ * compared exactly, power_charge included, so entries also have to be
+ * absorbed in the same order.
+ *
+ * The lists are built with find_create_process() like the trace
+ * handlers do. Pids come from a small range above any real pid, so that
+ * the same pid shows up with different comms, threads find their
+ * process and /proc has nothing to add; tgids and descriptions are drawn
+ * so that both kinds of match (and entries with both) are common. Every
+ * other list is merged with --threads on, which also checks how many
+ * threads each survivor ends up with.
+ *
+ *	cmake -DBUILD_BENCHMARKS=ON ... && make bench
+ *	./bench-merge-check [lists] [max processes]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+
+#include "process/process.h"
+#include "process/pid_cache.h"
+#include "bench.h"
+
+using namespace std;
+
+/* above PID_MAX_LIMIT, so no /proc/<pid> */
+#define FIRST_PID	5000000
+
+/* what the old merge sees of a process, and what it adds up */
+struct entry {
+	int		pid;
+	int		tgid;
+	char		desc[256];
+	uint64_t	accumulated_runtime;
+	uint64_t	child_runtime;
+	int		wake_ups;
+	int		disk_hits;
+	int		hard_disk_hits;
+	int		xwakes;
+	int		gpu_ops;
+	double		power_charge;
+	unsigned int	members;
+};
+
+static void take(struct entry *e, class process *proc)
+{
+	e->pid = proc->pid;
+	e->tgid = proc->tgid;
+	memcpy(e->desc, proc->desc, sizeof(e->desc));
+	e->accumulated_runtime = proc->accumulated_runtime;
+	e->child_runtime = proc->child_runtime;
+	e->wake_ups = proc->wake_ups;
+	e->disk_hits = proc->disk_hits;
+	e->hard_disk_hits = proc->hard_disk_hits;
+	e->xwakes = proc->xwakes;
+	e->gpu_ops = proc->gpu_ops;
+	e->power_charge = proc->power_charge;
+	e->members = 1;
+}
+
+static void merge_entry(struct entry *one, struct entry *two)
+{
+	one->accumulated_runtime += two->accumulated_runtime;
+	one->child_runtime += two->child_runtime;
+	one->wake_ups += two->wake_ups;
+	one->disk_hits += two->disk_hits;
+	one->hard_disk_hits += two->hard_disk_hits;
+	one->xwakes += two->xwakes;
+	one->gpu_ops += two->gpu_ops;
+	one->power_charge += two->power_charge;
+	one->members += two->members;
+}
+
+/* merge_processes() before the one pass */
+static void pairwise_merge(vector<struct entry> &list)
+{
+	vector<struct entry>::iterator it1, it2;
+
+	it1 = list.begin();
+	while (it1 != list.end()) {
+		it2 = it1 + 1;
+		while (it2 != list.end()) {
+			/* fold threads */
+			if (it1->pid == it2->tgid && it2->tgid != 0) {
+				merge_entry(&*it1, &*it2);
+				it2 = list.erase(it2);
+				continue;
+			}
+			/* find dupes and add up */
+			if (!strcmp(it1->desc, it2->desc)) {
+				merge_entry(&*it1, &*it2);
+				it2 = list.erase(it2);
+				continue;
+			}
+			++it2;
+		}
+		++it1;
+	}
+}
+
+static const char *comms[] = { "bash", "kworker/0:1", "firefox", "Web Content", "systemd" };
+
+static void fill(int processes, int pids)
+{
+	int i;
+
+	for (i = 0; i < processes; i++) {
+		class process *proc;
+
+		proc = find_create_process(comms[rand() % 5], FIRST_PID + rand() % pids);
+
+		if (rand() % 2)
+			proc->tgid = FIRST_PID + rand() % pids;
+		if (rand() % 3 == 0)
+			snprintf(proc->desc, sizeof(proc->desc), "[PID %d] %s", FIRST_PID + rand() % pids,
+				 comms[rand() % 5]);
+
+		proc->accumulated_runtime += rand() % 1000000;
+		proc->child_runtime += rand() % 1000;
+		proc->wake_ups += rand() % 100;
+		proc->disk_hits += rand() % 4;
+		proc->hard_disk_hits += rand() % 2;
+		proc->xwakes += rand() % 3;
+		proc->gpu_ops += rand() % 10;
+		proc->power_charge += (rand() % 1000) / 7.0;
+	}
+}
+
+static bool same(const struct entry *e, class process *proc)
+{
+	if (e->pid != proc->pid || strcmp(e->desc, proc->desc))
+		return false;
+	if (e->accumulated_runtime != proc->accumulated_runtime ||
+	    e->child_runtime != proc->child_runtime ||
+	    e->wake_ups != proc->wake_ups ||
+	    e->disk_hits != proc->disk_hits ||
+	    e->hard_disk_hits != proc->hard_disk_hits ||
+	    e->xwakes != proc->xwakes ||
+	    e->gpu_ops != proc->gpu_ops ||
+	    e->power_charge != proc->power_charge)
+		return false;
+	/* with --threads, only processes that had more than one keep the list */
+	if (thread_view && proc->nr_threads != (e->members > 1 ? e->members : 0))
+		return false;
+	return true;
+}
+
+int main(int argc, char **argv)
+{
+	int lists = argc > 1 ? atoi(argv[1]) : 20000;
+	int most = argc > 2 ? atoi(argv[2]) : 300;
+	unsigned long before = 0, after = 0;
+	vector<struct entry> expected;
+	unsigned int i;
+	int l, failed = 0;
+
+	srand(1);
+	for (l = 0; l < lists; l++) {
+		int processes = 1 + rand() % most;
+
+		thread_view = l % 2;
+		fill(processes, 1 + processes / 2);
+
+		expected.resize(all_processes.size());
+		for (i = 0; i < all_processes.size(); i++)
+			take(&expected[i], all_processes[i]);
+		before += expected.size();
+
+		pairwise_merge(expected);
+		merge_processes();
+		after += all_processes.size();
+
+		if (expected.size() != all_processes.size()) {
+			fprintf(stderr, "list %i: %u survivors, expected %u\n", l,
+				(unsigned int)all_processes.size(), (unsigned int)expected.size());
+			failed++;
+		} else for (i = 0; i < expected.size(); i++) {
+			if (!same(&expected[i], all_processes[i])) {
+				fprintf(stderr, "list %i: survivor %u (pid %i) differs\n", l, i,
+					all_processes[i]->pid);
+				failed++;
+				break;
+			}
+		}
+		clear_processes();
+	}
+	pid_cache_stop();
+
+	printf("%i lists, %lu processes merged into %lu: %i differ\n", lists, before, after, failed);
+	return failed ? 1 : 0;
+}
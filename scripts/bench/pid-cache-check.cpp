@@ -0,0 +1,147 @@
+/*
+ * Copyright 2010, Intel Corporation
+ *
+ * This file is part of PowerTOP
+ *
+ * This program file is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; version 2 of the License.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program in a file named COPYING; if not, write to the
+ * Free Software Foundation, Inc,
+ * 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1301 USA
+ * or just google for it.
+ */
+
+
+
+/*
+ * Pid cache check.
+ *
+ * Starts a shell that waits for a line on its stdin and then execs
+ * sleep, so that the same pid, with the same start time, first runs one
+ * program and then another. The pid cache has to give the old cmdline
+ * before the exec and the new one after it; otherwise the new program's
+ * process gets the old description, and merge_processes() folds it into
+ * the old program's entry.
+ *
+ *	cmake -DBUILD_BENCHMARKS=ON ... && make bench
+ *	./bench-pid-cache-check
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include <string>
+
+#include "process/pid_cache.h"
+#include "bench.h"
+
+using namespace std;
+
+static string cached_cmdline(int pid)
+{
+	const struct pid_info *info;
+
+	pid_cache_request(pid);
+	pid_cache_sync();
+	info = pid_cache_lookup(pid);
+	if (!info || !info->has_cmdline)
+		return "";
+	return info->cmdline;
+}
+
+/* wait up to 5 seconds for /proc/<pid>/comm to say comm */
+static bool wait_for_comm(int pid, const char *comm)
+{
+	char filename[64], line[64];
+	double start = bench_now();
+	FILE *file;
+
+	snprintf(filename, sizeof(filename), "/proc/%i/comm", pid);
+	while (bench_now() - start < 5) {
+		file = fopen(filename, "r");
+		if (file) {
+			if (fgets(line, sizeof(line), file)) {
+				line[strcspn(line, "\n")] = 0;
+				if (strcmp(line, comm) == 0) {
+					fclose(file);
+					return true;
+				}
+			}
+			fclose(file);
+		}
+		usleep(1000);
+	}
+	return false;
+}
+
+int main(void)
+{
+	string before, same, after;
+	int fds[2], failed = 0;
+	pid_t pid;
+
+	if (pipe(fds) < 0) {
+		perror("pipe");
+		return 2;
+	}
+	pid = fork();
+	if (pid < 0) {
+		perror("fork");
+		return 2;
+	}
+	if (pid == 0) {
+		dup2(fds[0], 0);
+		close(fds[0]);
+		close(fds[1]);
+		execl("/bin/sh", "sh", "-c", "read line; exec sleep 30", (char *)NULL);
+		_exit(127);
+	}
+	close(fds[0]);
+
+	if (!wait_for_comm(pid, "sh")) {
+		fprintf(stderr, "the shell did not start\n");
+		failed = 2;
+		goto out;
+	}
+	before = cached_cmdline(pid);
+	same = cached_cmdline(pid);
+
+	if (write(fds[1], "\n", 1) != 1 || !wait_for_comm(pid, "sleep")) {
+		fprintf(stderr, "the shell did not exec\n");
+		failed = 2;
+		goto out;
+	}
+	after = cached_cmdline(pid);
+
+	printf("before exec  \"%s\"\n", before.c_str());
+	printf("again        \"%s\"\n", same.c_str());
+	printf("after exec   \"%s\"\n", after.c_str());
+
+	if (before.compare(0, 3, "sh ") != 0 || same != before) {
+		fprintf(stderr, "wrong cmdline before the exec\n");
+		failed = 1;
+	}
+	if (after != "sleep 30 ") {
+		fprintf(stderr, "stale cmdline after the exec\n");
+		failed = 1;
+	}
+
+out:
+	close(fds[1]);
+	kill(pid, SIGKILL);
+	waitpid(pid, NULL, 0);
+	pid_cache_stop();
+	return failed;
+}
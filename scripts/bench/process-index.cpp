@@ -0,0 +1,151 @@
+/*
+ * Copyright 2010, Intel Corporation
+ *
+ * This file is part of PowerTOP
+ *
+ * This program file is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; version 2 of the License.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program in a file named COPYING; if not, write to the
+ * Free Software Foundation, Inc,
+ * 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1301 USA
+ * or just google for it.
+ */
+
+
+/*
+ * find_create_process() microbenchmark.
+ *
+ * Feeds a synthetic context switch storm over a given number of threads
+ * through find_create_process() from process.cpp and, for comparison,
+ * through the linear scan over all_processes it replaced. Every
+ * sched_switch and every sched_wakeup record costs one lookup, and the
+ * first lookup of a thread creates its process, just as within one
+ * measurement interval.
+ *
+ * Both sides create real process objects into all_processes. The pid
+ * cache worker is stopped first, so nothing reads /proc while the clock
+ * runs.
+ *
+ *	cmake -DBUILD_BENCHMARKS=ON ... && make bench
+ *	./bench-process-index [threads] [events]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+
+#include "process/process.h"
+#include "process/pid_cache.h"
+#include "bench.h"
+
+using namespace std;
+
+/* what find_create_process() was before the index */
+static class process *scan_find_create_process(const char *comm, int pid)
+{
+	unsigned int i;
+	class process *new_proc;
+
+	for (i = 0; i < all_processes.size(); i++) {
+		if (all_processes[i]->pid == pid && strcmp(comm, all_processes[i]->comm) == 0)
+			return all_processes[i];
+	}
+
+	new_proc = new class process(comm, pid);
+	all_processes.push_back(new_proc);
+	return new_proc;
+}
+
+static void scan_clear_processes(void)
+{
+	unsigned int i;
+
+	for (i = 0; i < all_processes.size(); i++)
+		delete all_processes[i];
+	all_processes.clear();
+}
+
+static class process *index_find_create_process(const char *comm, int pid)
+{
+	return find_create_process(comm, pid);
+}
+
+struct storm_event {
+	int pid;
+	const char *comm;
+};
+
+static double run(class process *(*find_create)(const char *, int),
+		  const vector<struct storm_event> &storm, unsigned long events, unsigned long *check)
+{
+	double start;
+	unsigned long i, sum = 0;
+
+	start = bench_now();
+	for (i = 0; i < events; i++) {
+		const struct storm_event *ev = &storm[i % storm.size()];
+
+		sum += find_create(ev->comm, ev->pid)->pid;
+	}
+	*check = sum + all_processes.size();
+	return bench_now() - start;
+}
+
+int main(int argc, char **argv)
+{
+	int threads = argc > 1 ? atoi(argv[1]) : 5000;
+	unsigned long events = argc > 2 ? atol(argv[2]) : 200000;
+	vector<char *> comms;
+	vector<struct storm_event> storm;
+	unsigned long scan_check, index_check, i;
+	double scan_time, index_time;
+	int t;
+
+	pid_cache_stop();
+
+	/* a few hundred thread pools with many workers each, like a busy build or server */
+	for (t = 0; t < 300; t++) {
+		char name[16];
+
+		snprintf(name, sizeof(name), "worker-%d", t);
+		comms.push_back(strdup(name));
+	}
+
+	srand(1);
+	for (i = 0; i < 1000000; i++) {
+		struct storm_event ev;
+
+		t = rand() % threads;
+		ev.pid = 1000 + t;
+		ev.comm = comms[t % comms.size()];
+		storm.push_back(ev);
+	}
+
+	scan_time = run(scan_find_create_process, storm, events, &scan_check);
+	scan_clear_processes();
+	index_time = run(index_find_create_process, storm, events, &index_check);
+	clear_processes();
+	pid_cache_stop();
+
+	if (scan_check != index_check) {
+		fprintf(stderr, "lookups differ\n");
+		return 1;
+	}
+	printf("%i threads, %lu events\n", threads, events);
+	printf("scan  %10.3f Mevents/s  %8.1f ns/event\n",
+	       events / scan_time / 1e6, scan_time * 1e9 / events);
+	printf("index %10.3f Mevents/s  %8.1f ns/event\n",
+	       events / index_time / 1e6, index_time * 1e9 / events);
+	printf("speedup %.1fx\n", scan_time / index_time);
+	return 0;
+}
@@ -0,0 +1,475 @@
+/*
+ * Copyright 2010, Intel Corporation
+ *
+ * This file is part of PowerTOP
+ *
+ * This program file is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; version 2 of the License.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program in a file named COPYING; if not, write to the
+ * Free Software Foundation, Inc,
+ * 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1301 USA
+ * or just google for it.
+ */
+
+
+/*
+ * Tracepoint decode microbenchmark.
+ *
+ * Compares the two ways the process bundle has turned a raw tracepoint
+ * record into the values its handlers need, on a synthetic stream of
+ * scheduler, timer, irq, softirq and workqueue records. The events are
+ * registered with libtraceevent from format text laid out like the
+ * kernel's format files, the same way a --replay does it.
+ *
+ *  - "tep":   what handle_trace_point() used to do for every sample.
+ *             tep_data_type(), tep_find_event(), a strcmp() chain over
+ *             the event names and tep_find_any_field() or
+ *             tep_get_field_val() for every field, against the real
+ *             libtraceevent.
+ *  - "table": what perf_bundle does now. Its decoder table is built by
+ *             perf_bundle::create_decoder() and each record goes through
+ *             perf_bundle::find_decoder() and perf_bundle::dispatch() to
+ *             a handler that reads its fields with trace_decoder.
+ *
+ * Both sides stop at the point where the handlers would start working on
+ * the decoded values, so the numbers are decode and dispatch cost only.
+ *
+ *	cmake -DBUILD_BENCHMARKS=ON ... && make bench
+ *	./bench-trace-decode [records] [passes]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include "perf/perf.h"
+#include "perf/perf_bundle.h"
+#include "bench.h"
+
+using namespace std;
+
+struct field_desc {
+	const char *decl;	/* as in the format file, "char prev_comm[16]" */
+	const char *name;
+	int offset;
+	int size;
+	int is_signed;
+};
+
+struct event_desc {
+	const char *name;
+	int weight;		/* share of the stream, in percent */
+	int size;		/* of the record, without the __data_loc payload */
+	struct field_desc fields[8];
+};
+
+static const struct field_desc common_desc[] = {
+	{ "unsigned short common_type", "common_type", 0, 2, 0 },
+	{ "unsigned char common_flags", "common_flags", 2, 1, 0 },
+	{ "unsigned char common_preempt_count", "common_preempt_count", 3, 1, 0 },
+	{ "int common_pid", "common_pid", 4, 4, 1 },
+	{ NULL, NULL, 0, 0, 0 }
+};
+
+static const struct event_desc event_desc[] = {
+	{ "sched_switch", 35, 64, {
+		{ "char prev_comm[16]", "prev_comm", 8, 16, 0 },
+		{ "pid_t prev_pid", "prev_pid", 24, 4, 1 },
+		{ "int prev_prio", "prev_prio", 28, 4, 1 },
+		{ "long prev_state", "prev_state", 32, 8, 1 },
+		{ "char next_comm[16]", "next_comm", 40, 16, 0 },
+		{ "pid_t next_pid", "next_pid", 56, 4, 1 },
+		{ "int next_prio", "next_prio", 60, 4, 1 },
+		{ NULL, NULL, 0, 0, 0 } } },
+	{ "sched_wakeup", 25, 40, {
+		{ "char comm[16]", "comm", 8, 16, 0 },
+		{ "pid_t pid", "pid", 24, 4, 1 },
+		{ "int prio", "prio", 28, 4, 1 },
+		{ "int target_cpu", "target_cpu", 32, 4, 1 },
+		{ NULL, NULL, 0, 0, 0 } } },
+	{ "irq_handler_entry", 3, 16, {
+		{ "int irq", "irq", 8, 4, 1 },
+		{ "__data_loc char[] name", "name", 12, 4, 1 },
+		{ NULL, NULL, 0, 0, 0 } } },
+	{ "irq_handler_exit", 3, 16, {
+		{ "int irq", "irq", 8, 4, 1 },
+		{ "int ret", "ret", 12, 4, 1 },
+		{ NULL, NULL, 0, 0, 0 } } },
+	{ "softirq_entry", 2, 16, {
+		{ "unsigned int vec", "vec", 8, 4, 0 },
+		{ NULL, NULL, 0, 0, 0 } } },
+	{ "softirq_exit", 2, 16, {
+		{ "unsigned int vec", "vec", 8, 4, 0 },
+		{ NULL, NULL, 0, 0, 0 } } },
+	{ "timer_expire_entry", 8, 40, {
+		{ "void * timer", "timer", 8, 8, 0 },
+		{ "unsigned long now", "now", 16, 8, 0 },
+		{ "void * function", "function", 24, 8, 0 },
+		{ "unsigned long baseclk", "baseclk", 32, 8, 0 },
+		{ NULL, NULL, 0, 0, 0 } } },
+	{ "timer_expire_exit", 8, 16, {
+		{ "void * timer", "timer", 8, 8, 0 },
+		{ NULL, NULL, 0, 0, 0 } } },
+	{ "hrtimer_expire_entry", 6, 32, {
+		{ "void * hrtimer", "hrtimer", 8, 8, 0 },
+		{ "s64 now", "now", 16, 8, 1 },
+		{ "void * function", "function", 24, 8, 0 },
+		{ NULL, NULL, 0, 0, 0 } } },
+	{ "hrtimer_expire_exit", 6, 16, {
+		{ "void * hrtimer", "hrtimer", 8, 8, 0 },
+		{ NULL, NULL, 0, 0, 0 } } },
+	{ "workqueue_execute_start", 1, 24, {
+		{ "void * work", "work", 8, 8, 0 },
+		{ "void * function", "function", 16, 8, 0 },
+		{ NULL, NULL, 0, 0, 0 } } },
+	{ "workqueue_execute_end", 1, 24, {
+		{ "void * work", "work", 8, 8, 0 },
+		{ "void * function", "function", 16, 8, 0 },
+		{ NULL, NULL, 0, 0, 0 } } },
+};
+
+#define NR_EVENTS (int)(sizeof(event_desc) / sizeof(event_desc[0]))
+#define FIRST_ID 300
+
+static uint64_t sink;
+
+static void format_fields(string &text, const struct field_desc *desc)
+{
+	char line[256];
+
+	for (; desc->decl; desc++) {
+		snprintf(line, sizeof(line), "\tfield:%s;\toffset:%d;\tsize:%d;\tsigned:%d;\n",
+			 desc->decl, desc->offset, desc->size, desc->is_signed);
+		text += line;
+	}
+}
+
+/* what /sys/kernel/tracing/events/<system>/<name>/format would say */
+static string format_text(int id, const struct event_desc *desc)
+{
+	string text;
+	char line[256];
+
+	snprintf(line, sizeof(line), "name: %s\nID: %d\nformat:\n", desc->name, id);
+	text = line;
+	format_fields(text, common_desc);
+	text += "\n";
+	format_fields(text, desc->fields);
+	snprintf(line, sizeof(line), "\nprint fmt: \"%s=%%llu\", REC->%s\n",
+		 desc->fields[0].name, desc->fields[0].name);
+	text += line;
+	return text;
+}
+
+/* --- before: libtraceevent lookups for every sample --- */
+
+static char *get_tep_field_str(void *trace, struct tep_event *event, struct tep_format_field *field)
+{
+	unsigned long long offset;
+
+	if (field->flags & TEP_FIELD_IS_DYNAMIC) {
+		offset = tep_read_number(event->tep, (char *)trace + field->offset, field->size);
+		offset &= 0xffff;
+		return (char *)trace + offset;
+	}
+	return (char *)trace + field->offset;
+}
+
+static void tep_handle_trace_point(void *trace)
+{
+	struct tep_event *event;
+	struct tep_record rec;
+	struct tep_format_field *field;
+	unsigned long long val;
+	uint64_t sum = 0;
+
+	rec.data = trace;
+	event = tep_find_event(perf_event::tep, tep_data_type(perf_event::tep, &rec));
+	if (!event)
+		return;
+
+	if (strcmp(event->name, "sched_switch") == 0) {
+		field = tep_find_any_field(event, "next_comm");
+		if (!field || !(field->flags & TEP_FIELD_IS_STRING))
+			return;
+		sum += get_tep_field_str(trace, event, field)[0];
+		if (tep_get_field_val(NULL, event, "next_pid", &rec, &val, 0) < 0)
+			return;
+		sum += val;
+		if (tep_get_field_val(NULL, event, "prev_pid", &rec, &val, 0) < 0)
+			return;
+		sum += val;
+	} else if (strcmp(event->name, "sched_wakeup") == 0) {
+		if (tep_get_common_field_val(NULL, event, "common_flags", &rec, &val, 0) < 0)
+			return;
+		sum += val;
+		field = tep_find_any_field(event, "comm");
+		if (!field || !(field->flags & TEP_FIELD_IS_STRING))
+			return;
+		sum += get_tep_field_str(trace, event, field)[0];
+		if (tep_get_field_val(NULL, event, "pid", &rec, &val, 0) < 0)
+			return;
+		sum += val;
+	} else if (strcmp(event->name, "irq_handler_entry") == 0) {
+		field = tep_find_any_field(event, "name");
+		if (!field || !(field->flags & TEP_FIELD_IS_STRING))
+			return;
+		sum += get_tep_field_str(trace, event, field)[0];
+		if (tep_get_field_val(NULL, event, "irq", &rec, &val, 0) < 0)
+			return;
+		sum += val;
+	} else if (strcmp(event->name, "irq_handler_exit") == 0) {
+		sum++;
+	} else if (strcmp(event->name, "softirq_entry") == 0) {
+		if (tep_get_field_val(NULL, event, "vec", &rec, &val, 0) < 0)
+			return;
+		sum += val;
+	} else if (strcmp(event->name, "softirq_exit") == 0) {
+		sum++;
+	} else if (strcmp(event->name, "timer_expire_entry") == 0) {
+		if (tep_get_field_val(NULL, event, "function", &rec, &val, 0) < 0)
+			return;
+		sum += val;
+		if (tep_get_field_val(NULL, event, "timer", &rec, &val, 0) < 0)
+			return;
+		sum += val;
+	} else if (strcmp(event->name, "timer_expire_exit") == 0) {
+		if (tep_get_field_val(NULL, event, "timer", &rec, &val, 0) < 0)
+			return;
+		sum += val;
+	} else if (strcmp(event->name, "hrtimer_expire_entry") == 0) {
+		if (tep_get_field_val(NULL, event, "function", &rec, &val, 0) < 0)
+			return;
+		sum += val;
+		if (tep_get_field_val(NULL, event, "hrtimer", &rec, &val, 0) < 0)
+			return;
+		sum += val;
+	} else if (strcmp(event->name, "hrtimer_expire_exit") == 0) {
+		if (tep_get_field_val(NULL, event, "hrtimer", &rec, &val, 0) < 0)
+			return;
+		sum += val;
+	} else if (strcmp(event->name, "workqueue_execute_start") == 0) {
+		if (tep_get_field_val(NULL, event, "function", &rec, &val, 0) < 0)
+			return;
+		sum += val;
+		if (tep_get_field_val(NULL, event, "work", &rec, &val, 0) < 0)
+			return;
+		sum += val;
+	} else if (strcmp(event->name, "workqueue_execute_end") == 0) {
+		if (tep_get_field_val(NULL, event, "work", &rec, &val, 0) < 0)
+			return;
+		sum += val;
+	}
+	sink += sum;
+}
+
+/* --- after: perf_bundle's decoder table --- */
+
+class bench_bundle: public perf_bundle
+{
+public:
+	bool add(unsigned int id, trace_handler handler, const char * const *fields)
+	{
+		return create_decoder(id, handler, fields) != NULL;
+	}
+
+	void decode(void *trace)
+	{
+		dispatch(find_decoder(trace), trace, 0, 0);
+	}
+};
+
+static void handle_two(class trace_decoder *decoder, void *trace, int, uint64_t)
+{
+	if (!decoder->has(0) || !decoder->has(1))
+		return;
+	sink += decoder->value(trace, 0) + decoder->value(trace, 1);
+}
+
+static void handle_one(class trace_decoder *decoder, void *trace, int, uint64_t)
+{
+	if (!decoder->has(0))
+		return;
+	sink += decoder->value(trace, 0);
+}
+
+static void handle_none(class trace_decoder *, void *, int, uint64_t)
+{
+	sink++;
+}
+
+static void handle_switch(class trace_decoder *decoder, void *trace, int, uint64_t)
+{
+	const char *comm = decoder->str(trace, 0);
+
+	if (!comm || !decoder->has(1) || !decoder->has(2))
+		return;
+	sink += comm[0] + decoder->value(trace, 1) + decoder->value(trace, 2);
+}
+
+static void handle_wakeup(class trace_decoder *decoder, void *trace, int, uint64_t)
+{
+	const char *comm;
+
+	if (!decoder->has(0))
+		return;
+	comm = decoder->str(trace, 1);
+	if (!comm || !decoder->has(2))
+		return;
+	sink += decoder->value(trace, 0) + comm[0] + decoder->value(trace, 2);
+}
+
+static void handle_irq_entry(class trace_decoder *decoder, void *trace, int, uint64_t)
+{
+	const char *name = decoder->str(trace, 0);
+
+	if (!name || !decoder->has(1))
+		return;
+	sink += name[0] + decoder->value(trace, 1);
+}
+
+struct table_entry {
+	trace_handler handler;
+	const char *fields[4];
+};
+
+/* in event_desc order: the fields each handler asks for, like the tables in do_process.cpp */
+static const struct table_entry table[] = {
+	{ handle_switch, { "next_comm", "next_pid", "prev_pid", NULL } },
+	{ handle_wakeup, { "common_flags", "comm", "pid", NULL } },
+	{ handle_irq_entry, { "name", "irq", NULL } },
+	{ handle_none, { NULL } },
+	{ handle_one, { "vec", NULL } },
+	{ handle_none, { NULL } },
+	{ handle_two, { "function", "timer", NULL } },
+	{ handle_one, { "timer", NULL } },
+	{ handle_two, { "function", "hrtimer", NULL } },
+	{ handle_one, { "hrtimer", NULL } },
+	{ handle_two, { "function", "work", NULL } },
+	{ handle_one, { "work", NULL } },
+};
+
+static bool setup(class bench_bundle &bundle)
+{
+	int i;
+
+	perf_event::tep_get();
+	for (i = 0; i < NR_EVENTS; i++) {
+		string text = format_text(FIRST_ID + i, &event_desc[i]);
+
+		tep_parse_event(perf_event::tep, text.c_str(), text.size(), "bench");
+		if (!bundle.add(FIRST_ID + i, table[i].handler, table[i].fields)) {
+			fprintf(stderr, "libtraceevent did not take the format of %s\n", event_desc[i].name);
+			return false;
+		}
+	}
+	return true;
+}
+
+static void make_stream(unsigned int count, vector<unsigned char> &buf, vector<size_t> &offsets)
+{
+	static const char irq_name[] = "ahci";
+	int pick[100];
+	unsigned int i;
+	int e, k = 0;
+
+	for (e = 0; e < NR_EVENTS; e++)
+		for (i = 0; i < (unsigned int)event_desc[e].weight && k < 100; i++)
+			pick[k++] = e;
+	while (k < 100)
+		pick[k++] = 0;
+
+	srand(1);
+	for (i = 0; i < count; i++) {
+		const struct event_desc *desc;
+		size_t at = buf.size();
+		uint16_t type;
+		uint32_t loc;
+		int f;
+
+		e = pick[rand() % 100];
+		desc = &event_desc[e];
+		buf.resize(at + desc->size + 8, 0);
+		type = FIRST_ID + e;
+		memcpy(&buf[at], &type, sizeof(type));
+		buf[at + 2] = rand() & 0x30;
+		for (f = 0; desc->fields[f].decl; f++) {
+			const struct field_desc *fd = &desc->fields[f];
+
+			if (strncmp(fd->decl, "__data_loc", 10) == 0) {
+				loc = (sizeof(irq_name) << 16) | desc->size;
+				memcpy(&buf[at + fd->offset], &loc, sizeof(loc));
+				memcpy(&buf[at + desc->size], irq_name, sizeof(irq_name));
+			} else if (strncmp(fd->decl, "char ", 5) == 0) {
+				snprintf((char *)&buf[at + fd->offset], fd->size, "kworker/%d", rand() % 64);
+			} else {
+				uint64_t v = rand();
+
+				memcpy(&buf[at + fd->offset], &v, fd->size);
+			}
+		}
+		offsets.push_back(at);
+	}
+}
+
+int main(int argc, char **argv)
+{
+	unsigned int count = argc > 1 ? atoi(argv[1]) : 1000000;
+	int passes = argc > 2 ? atoi(argv[2]) : 20;
+	class bench_bundle bundle;
+	vector<unsigned char> buf;
+	vector<size_t> offsets;
+	double start, tep_time, table_time;
+	uint64_t tep_sink, table_sink;
+	unsigned int i;
+	int p;
+
+	if (!setup(bundle))
+		return 1;
+	make_stream(count, buf, offsets);
+
+	sink = 0;
+	start = bench_now();
+	for (p = 0; p < passes; p++)
+		for (i = 0; i < count; i++)
+			tep_handle_trace_point(&buf[offsets[i]]);
+	tep_time = bench_now() - start;
+	tep_sink = sink;
+
+	sink = 0;
+	start = bench_now();
+	for (p = 0; p < passes; p++)
+		for (i = 0; i < count; i++)
+			bundle.decode(&buf[offsets[i]]);
+	table_time = bench_now() - start;
+	table_sink = sink;
+
+	bundle.release();
+	perf_event::tep_put();
+
+	if (tep_sink != table_sink) {
+		fprintf(stderr, "decoded values differ: %llu vs %llu\n",
+			(unsigned long long)tep_sink, (unsigned long long)table_sink);
+		return 1;
+	}
+
+	printf("%u records x %i passes\n", count, passes);
+	printf("tep   %8.2f Mevents/s  %6.1f ns/event\n",
+	       count * (double)passes / tep_time / 1e6, tep_time * 1e9 / count / passes);
+	printf("table %8.2f Mevents/s  %6.1f ns/event\n",
+	       count * (double)passes / table_time / 1e6, table_time * 1e9 / count / passes);
+	printf("speedup %.2fx\n", tep_time / table_time);
+	return 0;
+}
@@ -0,0 +1,72 @@
+#!/bin/sh
+#
+# Regression check for changes that must not alter the report: replay
+# one capture file (powertop --record) through two powertop binaries
+# and compare the CSV reports. The "System Information" section describes
+# the machine the report was generated on and the time it ran at, so it
+# is left out of the comparison.
+#
+# Both binaries have to read the capture's format version. A capture
+# made by a binary that predates the pid and symbol records (version 1)
+# gets its process names from the /proc of the machine it is replayed
+# on, so replay such captures on the machine that recorded them.
+#
+#	scripts/replay-compare.sh OLD_POWERTOP NEW_POWERTOP CAPTURE
+#
+# Exits 0 if the reports match, 1 if they differ (the diff is printed)
+# and 2 on usage or replay errors.
+
+if [ $# -ne 3 ]; then
+	echo "usage: $0 OLD_POWERTOP NEW_POWERTOP CAPTURE" >&2
+	exit 2
+fi
+
+old=$1
+new=$2
+capture=$3
+
+if [ ! -r "$capture" ]; then
+	echo "ERROR: cannot read $capture" >&2
+	exit 2
+fi
+
+tmp=$(mktemp -d) || exit 2
+trap 'rm -rf "$tmp"' EXIT
+
+# drop the System Information section: from its title up to the next title
+strip_system_info() {
+	awk '
+		/^_+$/ { held = $0; next }
+		held != "" {
+			skip = ($0 ~ /^ \*  \*  \*   System Information   \*  \*  \*$/)
+			if (!skip)
+				print held
+			held = ""
+		}
+		!skip { print }
+		END { if (held != "" && !skip) print held }
+	' "$1"
+}
+
+for side in old new; do
+	if [ $side = old ]; then
+		bin=$old
+	else
+		bin=$new
+	fi
+	echo "INFO: replaying $capture with $bin ..."
+	"$bin" --replay="$capture" --csv="$tmp/$side.csv" > "$tmp/$side.log" 2>&1
+	if [ $? -ne 0 ] || [ ! -s "$tmp/$side.csv" ]; then
+		echo "ERROR: $bin failed to replay $capture:" >&2
+		cat "$tmp/$side.log" >&2
+		exit 2
+	fi
+	strip_system_info "$tmp/$side.csv" > "$tmp/$side.report"
+done
+
+if diff -u "$tmp/old.report" "$tmp/new.report"; then
+	echo "INFO: reports match"
+	exit 0
+fi
+echo "INFO: reports differ" >&2
+exit 1
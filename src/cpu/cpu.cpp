@@ -39,6 +39,7 @@
 #include "../parameters/parameters.h"
 
 #include "../perf/perf_bundle.h"
+#include "../perf/perf_capture.h"
 #include "../lib.h"
 #include "../display.h"
 #include "../report/report.h"
@@ -47,17 +48,56 @@
 
 static class abstract_cpu system_level;
 
+extern int debug_learning;
+
 vector<class abstract_cpu *> all_cpus;
 
 static	class perf_bundle * perf_events;
 
 
 #ifndef _WIN32
-class perf_power_bundle: public perf_bundle
-{
-	virtual void handle_trace_point(void *trace, int cpu, uint64_t time);
+static void handle_cpu_idle(class trace_decoder *decoder, void *trace, int cpunr, uint64_t time);
+static void handle_cpu_frequency(class trace_decoder *decoder, void *trace, int cpunr, uint64_t time);
+static void handle_power_start(class trace_decoder *decoder, void *trace, int cpunr, uint64_t time);
+static void handle_power_end(class trace_decoder *decoder, void *trace, int cpunr, uint64_t time);
 
+enum { POWER_STATE };
+static const char * const power_state_fields[] = { "state", NULL };
+
+/*
+ * cpu_idle and cpu_frequency only touch their own cpu, but every change
+ * ripples up to its package, which pushes the effective frequency back
+ * down to all of its cores (cpu_package::freq_updated). Packages are the
+ * independent unit: the handlers queue the events per package and
+ * process_cpu_data() applies the queues of different packages in
+ * parallel, each one in time order. That only helps multi-socket hosts;
+ * with a single package the queue is applied on the calling thread.
+ */
+enum { CPU_EVENT_IDLE, CPU_EVENT_UNIDLE, CPU_EVENT_FREQ };
+
+struct cpu_event {
+	uint64_t time;
+	uint64_t freq;
+	class abstract_cpu *cpu;
+	int type;
 };
+
+static vector< vector<struct cpu_event> > package_events;
+static volatile unsigned int next_package;
+
+static void prepare_cpu_data(void)
+{
+	unsigned int i;
+
+	system_level.reset_pstate_data();
+
+	/* keeps the capacity from the last interval */
+	package_events.resize(system_level.children.size());
+	for (i = 0; i < package_events.size(); i++)
+		package_events[i].clear();
+}
+
+static const struct trace_consumer cpu_consumer = { "cpu", prepare_cpu_data };
 #endif /* !_WIN32 */
 
 
@@ -165,13 +205,15 @@ static class abstract_cpu * new_cpu(int number, char * vendor, int family, int m
 
 
 
+static void attach_cpu(unsigned int number, unsigned int package_number, unsigned int core_number,
+		       char *vendor, int family, int model);
+
 static void handle_one_cpu(unsigned int number, char *vendor, int family, int model)
 {
 	char filename[PATH_MAX];
 	ifstream file;
 	unsigned int package_number = 0;
 	unsigned int core_number = 0;
-	class abstract_cpu *package, *core, *cpu;
 
 	snprintf(filename, sizeof(filename), "/sys/devices/system/cpu/cpu%i/topology/core_id", number);
 	file.open(filename, ios::in);
@@ -191,6 +233,14 @@ static void handle_one_cpu(unsigned int number, char *vendor, int family, int mo
 		file.close();
 	}
 
+	attach_cpu(number, package_number, core_number, vendor, family, model);
+}
+
+/* hook cpu number into the package/core tree, creating levels as needed */
+static void attach_cpu(unsigned int number, unsigned int package_number, unsigned int core_number,
+		       char *vendor, int family, int model)
+{
+	class abstract_cpu *package, *core, *cpu;
 
 	if (system_level.children.size() <= package_number)
 		system_level.children.resize(package_number + 1, NULL);
@@ -229,6 +279,23 @@ static void handle_one_cpu(unsigned int number, char *vendor, int family, int mo
 	all_cpus[number] = cpu;
 }
 
+/*
+ * The cpus of the machine a trace was captured on. Only the generic
+ * models are used, a replay does not read MSRs or sysfs of this machine.
+ */
+static void enumerate_replay_cpus(void)
+{
+	vector<struct capture_cpu> cpus;
+	char vendor[] = "";
+	unsigned int i;
+
+	replay_topology(cpus);
+	for (i = 0; i < cpus.size(); i++) {
+		attach_cpu(cpus[i].number, cpus[i].package, cpus[i].core, vendor, 0, 0);
+		set_max_cpu(cpus[i].number);
+	}
+}
+
 static void handle_i965_gpu(void)
 {
 	unsigned int core_number = 0;
@@ -249,7 +316,7 @@ static void handle_i965_gpu(void)
 }
 
 
-void enumerate_cpus(void)
+static bool enumerate_local_cpus(void)
 {
 	ifstream file;
 	char line[4096];
@@ -262,7 +329,7 @@ void enumerate_cpus(void)
 	file.open("/proc/cpuinfo",  ios::in);
 
 	if (!file)
-		return;
+		return false;
 	/* Not all /proc/cpuinfo include "vendor_id\t". */
 	vendor[0] = '\0';
 
@@ -330,15 +397,26 @@ void enumerate_cpus(void)
 	if (access("/sys/class/drm/card0/power/rc6_residency_ms", R_OK) == 0)
 		handle_i965_gpu();
 
+	return true;
+}
+
+void enumerate_cpus(void)
+{
+	if (replay_active())
+		enumerate_replay_cpus();
+	else if (!enumerate_local_cpus())
+		return;
+
 #ifndef _WIN32
-	perf_events = new perf_power_bundle();
+	perf_events = trace_session_get();
+	perf_events->add_consumer(&cpu_consumer);
 
-	if (!perf_events->add_event("power","cpu_idle")){
-		perf_events->add_event("power","power_start");
-		perf_events->add_event("power","power_end");
+	if (!perf_events->add_event("power","cpu_idle", handle_cpu_idle, power_state_fields)){
+		perf_events->add_event("power","power_start", handle_power_start);
+		perf_events->add_event("power","power_end", handle_power_end);
 	}
-	if (!perf_events->add_event("power","cpu_frequency"))
-		perf_events->add_event("power","power_frequency");
+	if (!perf_events->add_event("power","cpu_frequency", handle_cpu_frequency, power_state_fields))
+		perf_events->add_event("power","power_frequency", handle_cpu_frequency, power_state_fields);
 #endif
 
 }
@@ -981,84 +1059,193 @@ struct power_entry {
 } __attribute__((packed));
 
 
-void perf_power_bundle::handle_trace_point(void *trace, int cpunr, uint64_t time)
+static class abstract_cpu *trace_cpu(int cpunr)
 {
-	struct tep_event *event;
-        struct tep_record rec; /* holder */
-	class abstract_cpu *cpu;
-	int type;
+	if (cpunr >= (int)all_cpus.size()) {
+		cout << "INVALID cpu nr in handle_trace_point\n";
+		return NULL;
+	}
 
-	rec.data = trace;
+	return all_cpus[cpunr];
+}
 
-	type = tep_data_type(perf_event::tep, &rec);
-	event = tep_find_event(perf_event::tep, type);
+static void queue_cpu_event(class abstract_cpu *cpu, int type, uint64_t time, uint64_t freq = 0)
+{
+	struct cpu_event event;
+	unsigned int package = 0;
+
+	if (cpu->parent && cpu->parent->parent)
+		package = cpu->parent->parent->get_number();
+	if (package >= package_events.size())
+		package_events.resize(package + 1);
+
+	event.time = time;
+	event.freq = freq;
+	event.cpu = cpu;
+	event.type = type;
+	package_events[package].push_back(event);
+}
 
-	if (!event)
+static void handle_cpu_idle(class trace_decoder *decoder, void *trace, int cpunr, uint64_t time)
+{
+	class abstract_cpu *cpu;
+	uint64_t val;
+
+	cpu = trace_cpu(cpunr);
+	if (!cpu)
 		return;
 
-	if (cpunr >= (int)all_cpus.size()) {
-		cout << "INVALID cpu nr in handle_trace_point\n";
+	if (!decoder->has(POWER_STATE)) {
+		fprintf(stderr, _("cpu_idle event returned no state?\n"));
+		exit(-1);
+	}
+	val = decoder->value(trace, POWER_STATE);
+
+	if (val == (unsigned int)-1)
+		queue_cpu_event(cpu, CPU_EVENT_UNIDLE, time);
+	else
+		queue_cpu_event(cpu, CPU_EVENT_IDLE, time);
+}
+
+/* cpu_frequency and the older power_frequency */
+static void handle_cpu_frequency(class trace_decoder *decoder, void *trace, int cpunr, uint64_t time)
+{
+	class abstract_cpu *cpu;
+
+	cpu = trace_cpu(cpunr);
+	if (!cpu)
 		return;
+
+	if (!decoder->has(POWER_STATE)) {
+		fprintf(stderr, _("power or cpu_frequency event returned no state?\n"));
+		exit(-1);
 	}
 
-	cpu = all_cpus[cpunr];
+	queue_cpu_event(cpu, CPU_EVENT_FREQ, time, decoder->value(trace, POWER_STATE));
+}
+
+static void handle_power_start(class trace_decoder *decoder, void *trace, int cpunr, uint64_t time)
+{
+	class abstract_cpu *cpu;
 
-#if 0
+	cpu = trace_cpu(cpunr);
+	if (cpu)
+		queue_cpu_event(cpu, CPU_EVENT_IDLE, time);
+}
+
+static void handle_power_end(class trace_decoder *decoder, void *trace, int cpunr, uint64_t time)
+{
+	class abstract_cpu *cpu;
+
+	cpu = trace_cpu(cpunr);
+	if (cpu)
+		queue_cpu_event(cpu, CPU_EVENT_UNIDLE, time);
+}
+
+static void apply_cpu_events(vector<struct cpu_event> &events)
+{
 	unsigned int i;
-	printf("Time is %llu \n", time);
-	for (i = 0; i < system_level.children.size(); i++)
-		if (system_level.children[i])
-			system_level.children[i]->validate();
-#endif
-	unsigned long long val;
-	int ret;
-	if (strcmp(event->name, "cpu_idle")==0) {
-
-		ret = tep_get_field_val(NULL, event, "state", &rec, &val, 0);
-                if (ret < 0) {
-                        fprintf(stderr, _("cpu_idle event returned no state?\n"));
-                        exit(-1);
-                }
-
-		if (val == (unsigned int)-1)
-			cpu->go_unidle(time);
-		else
-			cpu->go_idle(time);
+
+	for (i = 0; i < events.size(); i++) {
+		switch (events[i].type) {
+		case CPU_EVENT_IDLE:
+			events[i].cpu->go_idle(events[i].time);
+			break;
+		case CPU_EVENT_UNIDLE:
+			events[i].cpu->go_unidle(events[i].time);
+			break;
+		case CPU_EVENT_FREQ:
+			events[i].cpu->change_freq(events[i].time, events[i].freq);
+			break;
+		}
 	}
+}
 
-	if (strcmp(event->name, "power_frequency") == 0
-	|| strcmp(event->name, "cpu_frequency") == 0){
+static void *cpu_events_worker(void *arg)
+{
+	unsigned int i;
 
-		ret = tep_get_field_val(NULL, event, "state", &rec, &val, 0);
-		if (ret < 0) {
-			fprintf(stderr, _("power or cpu_frequency event returned no state?\n"));
-			exit(-1);
-		}
+	while ((i = __sync_fetch_and_add(&next_package, 1)) < package_events.size())
+		apply_cpu_events(package_events[i]);
+	return NULL;
+}
+
+/*
+ * Apply the queued events, one package per worker at a time. While that
+ * runs the packages are cut loose from system_level so that they do not
+ * race on its roll-up; that one is done once at the end, from the last
+ * event, which leaves it in the same state as doing it every time.
+ * A single busy package has nothing to run beside it and is applied in
+ * place, roll-up included, without starting any threads.
+ */
+static void apply_package_events(void)
+{
+	vector<pt_thread_t> threads;
+	unsigned int i, busy = 0, workers;
+	unsigned long count = 0;
+	uint64_t last = 0;
+	long nprocs;
+
+	for (i = 0; i < package_events.size(); i++) {
+		if (package_events[i].empty())
+			continue;
+		busy++;
+		count += package_events[i].size();
+		if (package_events[i].back().time > last)
+			last = package_events[i].back().time;
+	}
+	if (!busy)
+		return;
 
-		cpu->change_freq(time, val);
+	if (busy == 1) {
+		for (i = 0; i < package_events.size(); i++)
+			apply_cpu_events(package_events[i]);
+		if (debug_learning)
+			fprintf(stderr, "cpu: %lu P/C-state events on one package\n", count);
+		return;
 	}
 
-	if (strcmp(event->name, "power_start")==0)
-		cpu->go_idle(time);
-	if (strcmp(event->name, "power_end")==0)
-		cpu->go_unidle(time);
+	for (i = 0; i < system_level.children.size(); i++)
+		if (system_level.children[i])
+			system_level.children[i]->parent = NULL;
+
+	nprocs = sysconf(_SC_NPROCESSORS_ONLN);
+	workers = busy;
+	if (nprocs > 0 && workers > (unsigned long)nprocs)
+		workers = nprocs;
+
+	next_package = 0;
+	for (i = 1; i < workers; i++) {
+		pt_thread_t thread;
+
+		if (pt_thread_create(&thread, cpu_events_worker, NULL) == 0)
+			threads.push_back(thread);
+	}
+	cpu_events_worker(NULL);
+	for (i = 0; i < threads.size(); i++)
+		pt_thread_join(threads[i]);
 
-#if 0
-	unsigned int i;
 	for (i = 0; i < system_level.children.size(); i++)
 		if (system_level.children[i])
-			system_level.children[i]->validate();
-#endif
+			system_level.children[i]->parent = &system_level;
+	system_level.calculate_freq(last);
+
+	if (debug_learning)
+		fprintf(stderr, "cpu: %lu P/C-state events over %u packages on %lu threads\n",
+			count, busy, (unsigned long)threads.size() + 1);
 }
 #endif /* !_WIN32 */
 
 void process_cpu_data(void)
 {
 	unsigned int i;
-	system_level.reset_pstate_data();
 
 #ifndef _WIN32
+	/* resets the P-state data via prepare_cpu_data() */
 	perf_events->process();
+	apply_package_events();
+#else
+	system_level.reset_pstate_data();
 #endif
 
 	for (i = 0; i < system_level.children.size(); i++)
@@ -1080,8 +1267,8 @@ void clear_cpu_data(void)
 {
 #ifndef _WIN32
 	if (perf_events)
-		perf_events->release();
-	delete perf_events;
+		trace_session_put();
+	perf_events = NULL;
 #endif
 }
 
@@ -353,6 +353,20 @@ double ahci::power_usage(struct result_bundle *result, struct parameter_bundle *
 	return power;
 }
 
+bool ahci::power_terms(vector<struct power_term> &terms)
+{
+	struct power_term term;
+
+	term.scale = 1 / 100.0;
+	term.param = active_index;
+	term.result = active_rindex;
+	terms.push_back(term);
+	term.param = partial_index;
+	term.result = partial_rindex;
+	terms.push_back(term);
+	return true;
+}
+
 void ahci_create_device_stats_table(void)
 {
 	unsigned int i;
@@ -60,6 +60,7 @@ public:
 	virtual const char * device_name(void);
 	virtual const char * human_name(void) { return humanname;};
 	virtual double power_usage(struct result_bundle *result, struct parameter_bundle *bundle);
+	virtual bool power_terms(vector<struct power_term> &terms);
 	virtual int power_valid(void) { return utilization_power_valid(partial_rindex) + utilization_power_valid(active_rindex);};
 	virtual int grouping_prio(void) { return 1; };
 	virtual void report_device_stats(string *ahci_data, int idx);
@@ -193,6 +193,17 @@ double alsa::power_usage(struct result_bundle *result, struct parameter_bundle *
 	return power;
 }
 
+bool alsa::power_terms(vector<struct power_term> &terms)
+{
+	struct power_term term;
+
+	term.param = get_param_index("alsa-codec-power");
+	term.result = rindex;
+	term.scale = 1 / 100.0;
+	terms.push_back(term);
+	return true;
+}
+
 void alsa::register_power_with_devlist(struct result_bundle *results, struct parameter_bundle *bundle)
 {
 	register_devpower(&name[7], power_usage(results, bundle), this);
@@ -180,6 +180,11 @@ double devfreq::power_usage(struct result_bundle *result, struct parameter_bundl
 	return 0;
 }
 
+bool devfreq::power_terms(vector<struct power_term> &terms)
+{
+	return true;
+}
+
 double devfreq::utilization(void)
 {
 	return 0;
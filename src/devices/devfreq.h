@@ -60,6 +60,7 @@ public:
 	virtual const char * device_name(void) { return dir_name;};
 	virtual const char * human_name(void) { return "devfreq";};
 	virtual double power_usage(struct result_bundle *result, struct parameter_bundle *bundle);
+	virtual bool power_terms(vector<struct power_term> &terms);
 	virtual const char * util_units(void) { return " rpm"; };
 	virtual int power_valid(void) { return 0; /*utilization_power_valid(r_index);*/};
 	virtual int grouping_prio(void) { return 1; };
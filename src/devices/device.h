@@ -32,6 +32,13 @@
 struct parameter_bundle;
 struct result_bundle;
 
+/* scale * parameter * result, one linear piece of a device's power */
+struct power_term {
+	int	param;
+	int	result;
+	double	scale;
+};
+
 class device {
 public:
 	int cached_valid;
@@ -60,6 +67,14 @@ public:
 
 	virtual double power_usage(struct result_bundle *results, struct parameter_bundle *bundle) { return 0.0; };
 
+	/*
+	 * A device whose power_usage() is nothing but a sum of power_terms
+	 * appends them and returns true, so that the parameter fitting does
+	 * not have to call power_usage() for it. Valid until the next
+	 * precompute_valid().
+	 */
+	virtual bool power_terms(std::vector<struct power_term> &terms) { return false; };
+
 	virtual bool show_in_list(void) {return !hide;};
 
 	virtual int power_valid(void) { return 1;};
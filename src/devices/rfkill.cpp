@@ -175,6 +175,17 @@ double rfkill::power_usage(struct result_bundle *result, struct parameter_bundle
 	return power;
 }
 
+bool rfkill::power_terms(vector<struct power_term> &terms)
+{
+	struct power_term term;
+
+	term.param = index;
+	term.result = rindex;
+	term.scale = 1 / 100.0;
+	terms.push_back(term);
+	return true;
+}
+
 #else /* _WIN32 */
 void create_all_rfkills(void) { /* Not supported on Windows */ }
 #endif /* !_WIN32 */
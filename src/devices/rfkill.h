@@ -52,6 +52,7 @@ public:
 	virtual const char * device_name(void);
 	virtual const char * human_name(void) { return humanname; };
 	virtual double power_usage(struct result_bundle *result, struct parameter_bundle *bundle);
+	virtual bool power_terms(vector<struct power_term> &terms);
 	virtual int power_valid(void) { return utilization_power_valid(rindex);};
 	virtual int grouping_prio(void) { return 5; };
 };
@@ -139,6 +139,17 @@ double runtime_pmdevice::power_usage(struct result_bundle *result, struct parame
 	return power;
 }
 
+bool runtime_pmdevice::power_terms(vector<struct power_term> &terms)
+{
+	struct power_term term;
+
+	term.param = index;
+	term.result = r_index;
+	term.scale = 1 / 100.0;
+	terms.push_back(term);
+	return true;
+}
+
 void runtime_pmdevice::set_human_name(char *_name)
 {
 	pt_strcpy(humanname, _name);
@@ -213,6 +213,20 @@ double usbdevice::power_usage(struct result_bundle *result, struct parameter_bun
 	return power;
 }
 
+bool usbdevice::power_terms(vector<struct power_term> &terms)
+{
+	struct power_term term;
+
+	if (rootport || !cached_valid)
+		return true;
+
+	term.param = index;
+	term.result = r_index;
+	term.scale = 1 / 100.0;
+	terms.push_back(term);
+	return true;
+}
+
 static void create_all_usb_devices_callback(const char *d_name)
 {
 	char filename[PATH_MAX];
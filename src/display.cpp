@@ -73,6 +73,7 @@ void init_display(void)
 	create_tab("Idle stats", _("Idle stats"));
 	create_tab("Frequency stats", _("Frequency stats"));
 	create_tab("Device stats", _("Device stats"));
+	create_tab("Cgroups", _("Cgroups"));
 
 	display = 1;
 }
@@ -24,6 +24,8 @@
  *	Peter Anvin
  */
 #include <map>
+#include <vector>
+#include <algorithm>
 #include <string.h>
 #include <iostream>
 #include <utility>
@@ -38,6 +40,7 @@
 
 #include "lib.h"
 #include "platform/platform.h"
+#include "perf/perf_capture.h"
 
 #ifndef HAVE_NO_PCI
 #  ifndef _WIN32
@@ -71,6 +74,7 @@ extern "C" {
 #  include <ncurses.h>
 #endif
 
+/* 0: not started, 1: read inline, 2: thread running, 3: ready */
 static int kallsyms_read = 0;
 
 int is_turbo(uint64_t freq, uint64_t max, uint64_t maxmo)
@@ -122,20 +126,42 @@ char *hz_to_human(unsigned long hz, char *buffer, int digits)
 
 using namespace std;
 
-map<unsigned long, string> kallsyms;
+/*
+ * Kernel symbols, sorted by address, with all names in one string pool.
+ * /proc/kallsyms is a couple of hundred thousand lines; this is a small
+ * fraction of what a map<unsigned long, string> of it costs. It is read
+ * on a background thread started at init, kernel_function() waits for
+ * it the first time it is needed. A replay uses the names that were
+ * recorded with the capture and does not read it at all.
+ */
+struct kallsym {
+	unsigned long address;
+	unsigned int name;	/* offset into kallsyms_names */
+};
+
+static vector<struct kallsym> kallsyms;
+static vector<char> kallsyms_names;
+static pt_thread_t kallsyms_thread;
+
+extern int debug_learning;
+
+static bool kallsym_before(const struct kallsym &a, const struct kallsym &b)
+{
+	return a.address < b.address;
+}
 
-static void read_kallsyms(void)
+static void *read_kallsyms(void *arg)
 {
 #ifndef _WIN32
 	ifstream file;
 	char line[1024];
-	kallsyms_read = 1;
+	unsigned int i, j;
 
 	file.open("/proc/kallsyms", ios::in);
 
 	while (file) {
 		char *c = NULL, *c2 = NULL;
-		unsigned long address = 0;
+		struct kallsym sym;
 		memset(line, 0, 1024);
 		file.getline(line, 1024);
 		c = strchr(line, ' ');
@@ -146,29 +172,81 @@ static void read_kallsyms(void)
 		if (*c2) c2++;
 		if (*c2) c2++;
 
-		address = strtoull(line, NULL, 16);
+		sym.address = strtoull(line, NULL, 16);
 		c = strchr(c2, '\t');
 		if (c)
 			*c = 0;
-		if (address != 0)
-			kallsyms[address] = c2;
+		if (sym.address == 0)
+			continue;
+
+		sym.name = kallsyms_names.size();
+		kallsyms_names.insert(kallsyms_names.end(), c2, c2 + strlen(c2) + 1);
+		kallsyms.push_back(sym);
 	}
 	file.close();
-#else
-	kallsyms_read = 1; /* no kernel symbols on Windows */
+
+	/* for addresses listed twice the last name wins */
+	stable_sort(kallsyms.begin(), kallsyms.end(), kallsym_before);
+	for (i = 0, j = 0; i < kallsyms.size(); i++) {
+		if (j && kallsyms[j - 1].address == kallsyms[i].address)
+			j--;
+		kallsyms[j++] = kallsyms[i];
+	}
+	kallsyms.resize(j);
+
+	vector<struct kallsym>(kallsyms).swap(kallsyms);
+	vector<char>(kallsyms_names).swap(kallsyms_names);
 #endif
+	return NULL;
 }
 
-const char *kernel_function(uint64_t address)
+void start_kallsyms_load(void)
+{
+	if (kallsyms_read || replay_active())
+		return;
+	kallsyms_read = 1;
+	if (pt_thread_create(&kallsyms_thread, read_kallsyms, NULL) == 0)
+		kallsyms_read = 2;
+	else
+		read_kallsyms(NULL);
+}
+
+static void wait_for_kallsyms(void)
 {
-	const char *c;
 	if (!kallsyms_read)
-		read_kallsyms();
+		start_kallsyms_load();
+	if (kallsyms_read == 2)
+		pt_thread_join(kallsyms_thread);
+	kallsyms_read = 3;
+
+	if (debug_learning)
+		fprintf(stderr, "kallsyms: %lu symbols, %lu kB\n", (unsigned long)kallsyms.size(),
+			(unsigned long)(kallsyms.capacity() * sizeof(struct kallsym) +
+					kallsyms_names.capacity()) / 1024);
+}
 
-	c = kallsyms[address].c_str();
-	if (!c)
-		return "";
-	return c;
+const char *kernel_function(uint64_t address)
+{
+	vector<struct kallsym>::iterator it;
+	struct kallsym key;
+	const char *name;
+
+	if (replay_active())
+		return replay_kernel_symbol(address);
+
+	if (kallsyms_read != 3)
+		wait_for_kallsyms();
+
+	key.address = address;
+	key.name = 0;
+	it = lower_bound(kallsyms.begin(), kallsyms.end(), key, kallsym_before);
+	if (it == kallsyms.end() || it->address != address)
+		name = "";
+	else
+		name = &kallsyms_names[it->name];
+
+	capture_kernel_symbol(address, name);
+	return name;
 }
 
 static int _max_cpu;
@@ -57,6 +57,7 @@ extern char *hz_to_human(unsigned long hz, char *buffer, int digits = 2);
 
 
 extern const char *kernel_function(uint64_t address);
+extern void start_kallsyms_load(void);
 
 
 
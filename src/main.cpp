@@ -47,8 +47,10 @@
 
 #include "cpu/cpu.h"
 #include "process/process.h"
+#include "process/cgroup.h"
 #include "perf/perf.h"
 #include "perf/perf_bundle.h"
+#include "perf/perf_capture.h"
 #include "lib.h"
 #ifdef HAVE_CONFIG_H
 #  include "config.h"
@@ -80,7 +82,12 @@ enum {
 	OPT_AUTO_TUNE = CHAR_MAX + 1,
 	OPT_AUTO_TUNE_DUMP,
 	OPT_EXTECH,
-	OPT_DEBUG
+	OPT_DEBUG,
+	OPT_TRACE_DRAIN,
+	OPT_TRACE_PAGES,
+	OPT_RECORD,
+	OPT_REPLAY,
+	OPT_THREADS
 };
 
 static const struct option long_options[] =
@@ -95,8 +102,13 @@ static const struct option long_options[] =
 	{"html",	optional_argument,	NULL,		 'r'},
 	{"iteration",	optional_argument,	NULL,		 'i'},
 	{"quiet",	no_argument,		NULL,		 'q'},
+	{"record",	required_argument,	NULL,		 OPT_RECORD},
+	{"replay",	required_argument,	NULL,		 OPT_REPLAY},
 	{"sample",	optional_argument,	NULL,		 's'},
+	{"threads",	no_argument,		NULL,		 OPT_THREADS},
 	{"time",	optional_argument,	NULL,		 't'},
+	{"trace-drain",	no_argument,		NULL,		 OPT_TRACE_DRAIN},
+	{"trace-pages",	required_argument,	NULL,		 OPT_TRACE_PAGES},
 	{"workload",	optional_argument,	NULL,		 'w'},
 	{"version",	no_argument,		NULL,		 'V'},
 	{"help",	no_argument,		NULL,		 'h'},
@@ -134,8 +146,13 @@ static void print_usage()
 	printf(" -r, --html%s\t %s\n", _("[=filename]"), _("generate a html report"));
 	printf(" -i, --iteration%s\n", _("[=iterations] number of times to run each test"));
 	printf(" -q, --quiet\t\t %s\n", _("suppress stderr output"));
+	printf("     --record%s\t %s\n", _("=filename"), _("save the trace events to a capture file"));
+	printf("     --replay%s\t %s\n", _("=filename"), _("generate a report from a capture file instead of live tracing"));
 	printf(" -s, --sample%s\t %s\n", _("[=seconds]"), _("interval for power consumption measurement"));
+	printf("     --threads\t\t %s\n", _("also account every thread of a process on its own"));
 	printf(" -t, --time%s\t %s\n", _("[=seconds]"), _("generate a report for 'x' seconds"));
+	printf("     --trace-drain\t %s\n", _("drain trace buffers continuously in a background thread"));
+	printf("     --trace-pages%s %s\n", _("=min[,max]"), _("limits for the per cpu trace buffer size, in pages"));
 	printf(" -w, --workload%s %s\n", _("[=workload]"), _("file to execute for workload"));
 	printf(" -V, --version\t\t %s\n", _("print version information"));
 	printf(" -h, --help\t\t %s\n", _("print this help menu"));
@@ -263,6 +280,7 @@ void one_measurement(int seconds, int sample_interval, char *workload)
 
 	/* output stats */
 	process_update_display();
+	cgroup_update_display();
 	report_summary();
 	w_display_cpu_cstates();
 	w_display_cpu_pstates();
@@ -271,6 +289,8 @@ void one_measurement(int seconds, int sample_interval, char *workload)
 		report_display_cpu_pstates();
 	}
 	report_process_update_display();
+	report_cgroup_update_display();
+	report_lost_samples();
 	tuning_update_display();
 	wakeup_update_display();
 	end_process_data();
@@ -336,6 +356,19 @@ static void checkroot() {
 
 }
 
+static void register_default_parameters(void)
+{
+	register_parameter("base power", 100, 0.5);
+	register_parameter("cpu-wakeups", 39.5);
+	register_parameter("cpu-consumption", 1.56);
+	register_parameter("gpu-operations", 0.5576);
+	register_parameter("disk-operations-hard", 0.2);
+	register_parameter("disk-operations", 0.0);
+	register_parameter("xwakes", 0.1);
+
+	resolve_consumer_costs();
+}
+
 static void powertop_init(int auto_tune)
 {
 	static char initialized = 0;
@@ -368,6 +401,9 @@ static void powertop_init(int auto_tune)
 
 	srand(time(NULL));
 
+	/* ready by the time the first timer or work item needs it */
+	start_kallsyms_load();
+
 	platform_create_data_dir();
 
 	load_results("saved_results.powertop");
@@ -378,19 +414,57 @@ static void powertop_init(int auto_tune)
 	create_all_devfreq_devices();
 	detect_power_meters();
 
-	register_parameter("base power", 100, 0.5);
-	register_parameter("cpu-wakeups", 39.5);
-	register_parameter("cpu-consumption", 1.56);
-	register_parameter("gpu-operations", 0.5576);
-	register_parameter("disk-operations-hard", 0.2);
-	register_parameter("disk-operations", 0.0);
-	register_parameter("xwakes", 0.1);
+	register_default_parameters();
 
         load_parameters("saved_parameters.powertop");
 
 	initialized = 1;
 }
 
+/*
+ * Run the accounting over a capture taken with --record instead of live
+ * trace points; this needs neither root nor a kernel with tracing. Each
+ * interval of the capture becomes one section of the report.
+ */
+static void replay_trace(const char *capture, char *file, size_t len)
+{
+	if (!replay_open(capture))
+		exit(EXIT_FAILURE);
+
+	enumerate_cpus();
+	register_default_parameters();
+
+	if (reporttype == REPORT_OFF) {
+		reporttype = REPORT_HTML;
+		snprintf(file, len, "%s", "powertop.html");
+	}
+	init_report_output(file, 1);
+
+	while (replay_pending()) {
+		start_process_measurement();
+		end_process_measurement();
+
+		process_cpu_data();
+		process_process_data();
+
+		report_summary();
+		report_display_cpu_cstates();
+		report_display_cpu_pstates();
+		report_process_update_display();
+		report_cgroup_update_display();
+		report_lost_samples();
+
+		end_process_data();
+		end_cpu_data();
+	}
+
+	finish_report_output();
+	clear_process_data();
+	clear_cpu_data();
+	replay_close();
+	exit(0);
+}
+
 void clean_shutdown()
 {
 	close_results();
@@ -409,6 +483,7 @@ int main(int argc, char **argv)
 	int c;
 	char filename[PATH_MAX];
 	char workload[PATH_MAX] = {0};
+	char replay_file[PATH_MAX] = {0};
 	int  iterations = 1, auto_tune = 0, sample_interval = 5;
 	bool auto_tune_dump = false;
 
@@ -450,6 +525,36 @@ int main(int argc, char **argv)
 		case OPT_DEBUG:
 			/* implemented using getopt_long(3) flag */
 			break;
+		case OPT_TRACE_DRAIN:
+			perf_background_drain = 1;
+			break;
+		case OPT_TRACE_PAGES:
+			if (sscanf(optarg, "%i,%i", &perf_ring_min_pages, &perf_ring_max_pages) == 1 &&
+			    perf_ring_max_pages < perf_ring_min_pages)
+				perf_ring_max_pages = perf_ring_min_pages;
+			if (perf_ring_min_pages <= 0 || perf_ring_max_pages < perf_ring_min_pages) {
+				fprintf(stderr, _("Invalid trace buffer size %s\n"), optarg);
+				exit(1);
+			}
+			break;
+		case OPT_THREADS:
+			thread_view = 1;
+			break;
+		case OPT_RECORD:
+#ifndef _WIN32
+			if (!capture_open(optarg))
+				exit(EXIT_FAILURE);
+#else
+			fprintf(stderr, _("Trace capture not supported on Windows.\n"));
+#endif
+			break;
+		case OPT_REPLAY:
+#ifndef _WIN32
+			snprintf(replay_file, sizeof(replay_file), "%s", optarg);
+#else
+			fprintf(stderr, _("Trace replay not supported on Windows.\n"));
+#endif
+			break;
 		case OPT_EXTECH:	/* Extech power analyzer support */
 			checkroot();
 #ifndef _WIN32
@@ -502,6 +607,9 @@ int main(int argc, char **argv)
 		}
 	}
 
+	if (replay_file[0])
+		replay_trace(replay_file, filename, sizeof(filename));
+
 	powertop_init(auto_tune);
 
 	if (reporttype != REPORT_OFF)
@@ -540,7 +648,7 @@ int main(int argc, char **argv)
 		if (!auto_tune)
 			show_cur_tab();
 		one_measurement(time_out, sample_interval, NULL);
-		learn_parameters(15, 0);
+		update_parameters();
 	}
 	if (!auto_tune)
 		endwin();
@@ -560,6 +668,7 @@ int main(int argc, char **argv)
 	reset_display();
 
 	clean_shutdown();
+	capture_close();
 
 	return 0;
 }
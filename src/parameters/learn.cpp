@@ -24,22 +24,41 @@
  */
 #include "parameters.h"
 #include "../measurement/measurement.h"
+#include "../platform/platform.h"
 
 #include <stdio.h>
 #include <stdlib.h>
 #include <math.h>
+#include <time.h>
+#include <atomic>
 
 extern int debug_learning;
 
+/* compute_bundle() over all of past_results, in one pass over the power model */
 double calculate_params(struct parameter_bundle *params)
 {
+	vector<double> power;
 	unsigned int i;
+	double actual;
+	static int bpi = 0;
+
+	if (!bpi)
+		bpi = get_param_index("base power");
 
 	params->score = 0;
+	if (past_results.empty())
+		return params->score;
 
+	past_results_power(params, power);
+	for (i = 0; i < past_results.size(); i++) {
+		actual = past_results[i]->power;
+		params->score += actual * (power[i] - actual) * (power[i] - actual);
+	}
 
-	for (i = 0; i < past_results.size(); i++)
-		compute_bundle(params, past_results[i]);
+	/* and what compute_bundle() leaves behind for the last one */
+	params->actual_power = past_results.back()->power;
+	params->guessed_power = power.back();
+	params->parameters[bpi] = power.back();
 
 	return params->score;
 }
@@ -100,38 +119,638 @@ static void weed_empties(struct parameter_bundle *best_so_far)
 
 }
 
-/* leaks like a sieve */
-void learn_parameters(int iterations, int do_base_power)
+/*
+ * Every device's power_usage() is linear in the parameters (a few add a
+ * constant on top), so the fit that the hill climber below searches for
+ * is a weighted non-negative least squares problem:
+ *
+ *	minimize  sum_r  power_r * (offset_r + sum_j usage_rj * x_j - power_r)^2
+ *	subject to  0 <= x_j <= 5000
+ *
+ * which is the score calculate_params() gives. Base power is not part of
+ * it, compute_bundle() leaves it out of the estimate and overwrites it,
+ * so it is not fitted either. The usage matrix is found by evaluating the
+ * devices with one parameter at a time set to 1.
+ */
+#define PARAM_MAX	5000.0
+
+struct linear_model {
+	unsigned int	rows;
+	unsigned int	cols;
+	vector<double>	usage;		/* rows x cols, row major */
+	vector<double>	offset;		/* device power with every parameter 0 */
+};
+
+static double devices_power(vector<class device *> &devices, struct result_bundle *result,
+			    struct parameter_bundle *bundle)
 {
-	struct parameter_bundle *best_so_far;
-	double best_score = 10000000000000000.0;
-	int retry = iterations;
-	int prevparam = -1;
-	int locked = 0;
-	static unsigned int bpi = 0;
+	double power = 0;
 	unsigned int i;
-	time_t start;
 
-	/* don't start fitting anything until we have at least 1 more measurement than we have parameters */
-	if (past_results.size() <= all_parameters.parameters.size())
+	for (i = 0; i < devices.size(); i++)
+		power += devices[i]->power_usage(result, bundle);
+	return power;
+}
+
+/*
+ * The columns of the devices in the power_terms table come straight out
+ * of it; only the others need to be evaluated with one parameter at a
+ * time set to 1. probe has to have all parameters at 0.
+ */
+static double model_row(struct result_bundle *result, const vector<struct power_term> &terms,
+			vector<class device *> &other, struct parameter_bundle *probe,
+			unsigned int bpi, double *row)
+{
+	unsigned int j, t, cols = probe->parameters.size();
+	double offset;
+
+	for (j = 0; j < cols; j++)
+		row[j] = 0.0;
+	for (t = 0; t < terms.size(); t++)
+		row[terms[t].param] += terms[t].scale * get_result_value(terms[t].result, result);
+
+	offset = devices_power(other, result, probe);
+	for (j = 1; j < cols && !other.empty(); j++) {
+		if (j == bpi)
+			continue;
+		probe->parameters[j] = 1.0;
+		row[j] += devices_power(other, result, probe) - offset;
+		probe->parameters[j] = 0.0;
+	}
+	return offset;
+}
+
+static void build_model(struct linear_model *model, unsigned int bpi)
+{
+	struct parameter_bundle probe;
+	vector<struct power_term> terms;
+	vector<class device *> other;
+	unsigned int r;
+
+	power_model_terms(terms, other);
+
+	model->rows = past_results.size();
+	model->cols = all_parameters.parameters.size();
+	model->usage.resize(model->rows * model->cols);
+	model->offset.resize(model->rows);
+
+	probe.parameters.assign(model->cols, 0.0);
+	probe.weights = all_parameters.weights;
+
+	for (r = 0; r < model->rows; r++)
+		model->offset[r] = model_row(past_results[r], terms, other, &probe, bpi,
+					     &model->usage[r * model->cols]);
+}
+
+/* factor symmetric positive definite a (n x n) in place into its lower Cholesky factor */
+static bool cholesky(vector<double> &a, unsigned int n)
+{
+	unsigned int i, j, k;
+	double sum;
+
+	for (j = 0; j < n; j++) {
+		sum = a[j * n + j];
+		for (k = 0; k < j; k++)
+			sum -= a[j * n + k] * a[j * n + k];
+		if (sum <= 0)
+			return false;
+		a[j * n + j] = sqrt(sum);
+		for (i = j + 1; i < n; i++) {
+			sum = a[i * n + j];
+			for (k = 0; k < j; k++)
+				sum -= a[i * n + k] * a[j * n + k];
+			a[i * n + j] = sum / a[j * n + j];
+		}
+	}
+	return true;
+}
+
+static void cholesky_solve(const vector<double> &l, double *b, unsigned int n)
+{
+	unsigned int i, k;
+	double sum;
+
+	for (i = 0; i < n; i++) {
+		sum = b[i];
+		for (k = 0; k < i; k++)
+			sum -= l[i * n + k] * b[k];
+		b[i] = sum / l[i * n + i];
+	}
+	for (i = n; i-- > 0; ) {
+		sum = b[i];
+		for (k = i + 1; k < n; k++)
+			sum -= l[k * n + i] * b[k];
+		b[i] = sum / l[i * n + i];
+	}
+}
+
+/* solve a * x = b in place for symmetric positive definite a (n x n) */
+static bool solve_spd(vector<double> &a, vector<double> &b, unsigned int n)
+{
+	if (!cholesky(a, n))
+		return false;
+	if (n)
+		cholesky_solve(a, &b[0], n);
+	return true;
+}
+
+/*
+ * Lawson-Hanson active set NNLS on the normal equations g * x = h (m x m).
+ * Variables with fixed[j] set stay at x[j] and are only moved to the right
+ * hand side.
+ */
+static void nnls(const vector<double> &g, const vector<double> &h, unsigned int m,
+		 const vector<bool> &fixed, vector<double> &x)
+{
+	vector<bool> passive(m, false);
+	vector<unsigned int> set;
+	vector<double> a, z;
+	unsigned int i, j, k, iter;
+	double tol = 1e-10, best, alpha;
+
+	for (j = 0; j < m; j++)
+		if (!fixed[j])
+			x[j] = 0.0;
+
+	for (iter = 0; iter < 3 * m; iter++) {
+		unsigned int pick = m;
+
+		/* the steepest free variable that would still go up */
+		best = tol;
+		for (j = 0; j < m; j++) {
+			double w = h[j];
+
+			if (passive[j] || fixed[j])
+				continue;
+			for (k = 0; k < m; k++)
+				w -= g[j * m + k] * x[k];
+			if (w > best) {
+				best = w;
+				pick = j;
+			}
+		}
+		if (pick == m)
+			break;
+		passive[pick] = true;
+
+		while (1) {
+			set.clear();
+			for (j = 0; j < m; j++)
+				if (passive[j])
+					set.push_back(j);
+
+			a.resize(set.size() * set.size());
+			z.resize(set.size());
+			for (i = 0; i < set.size(); i++) {
+				z[i] = h[set[i]];
+				for (k = 0; k < m; k++)
+					if (fixed[k])
+						z[i] -= g[set[i] * m + k] * x[k];
+				for (j = 0; j < set.size(); j++)
+					a[i * set.size() + j] = g[set[i] * m + set[j]];
+			}
+			if (!solve_spd(a, z, set.size())) {
+				passive[pick] = false;
+				break;
+			}
+
+			alpha = 2.0;
+			for (i = 0; i < set.size(); i++)
+				if (z[i] <= tol && x[set[i]] - z[i] > 0)
+					alpha = min(alpha, x[set[i]] / (x[set[i]] - z[i]));
+
+			if (alpha > 1.0) {
+				for (i = 0; i < set.size(); i++)
+					x[set[i]] = z[i];
+				break;
+			}
+
+			/* step back to where the first one hits zero and drop those */
+			for (i = 0; i < set.size(); i++) {
+				x[set[i]] += alpha * (z[i] - x[set[i]]);
+				if (x[set[i]] <= tol) {
+					x[set[i]] = 0.0;
+					passive[set[i]] = false;
+				}
+			}
+		}
+	}
+}
+
+/*
+ * Between full fits, the results of each new measurement interval are
+ * folded into the last fit by recursive least squares, with the same
+ * weighting and an exponential forgetting factor:
+ *
+ *	k     = P x / (lambda / power + x' P x)
+ *	theta = theta + k (power - offset - x' theta)
+ *	P     = (P - k x' P) / lambda
+ *
+ * P starts out as the inverse of the normal equations of the full fit.
+ * Only the parameters that fit found any device reacting to are updated;
+ * the others wait for the next one.
+ */
+#define RLS_FORGET	0.995
+#define RLS_REFIT	20	/* updates between full fits */
+
+struct rls_state {
+	bool			valid;
+	unsigned int		params;		/* all_parameters.parameters.size() */
+	unsigned int		updates;
+	struct result_bundle	*last;		/* newest_result last folded in */
+	vector<unsigned int>	live;
+	vector<double>		theta;
+	vector<double>		upper;
+	vector<double>		p;		/* live x live */
+};
+
+static struct rls_state rls;
+
+static void start_rls(const vector<unsigned int> &live, vector<double> &g,
+		      const vector<double> &x, const vector<double> &upper)
+{
+	unsigned int i, j, m = live.size();
+	vector<double> column(m);
+
+	rls.valid = false;
+	if (!m || !cholesky(g, m))
 		return;
 
+	rls.p.resize(m * m);
+	for (j = 0; j < m; j++) {
+		column.assign(m, 0.0);
+		column[j] = 1.0;
+		cholesky_solve(g, &column[0], m);
+		for (i = 0; i < m; i++)
+			rls.p[i * m + j] = column[i];
+	}
 
+	rls.live = live;
+	rls.theta = x;
+	rls.upper = upper;
+	rls.params = all_parameters.parameters.size();
+	rls.updates = 0;
+	rls.valid = true;
+}
 
-//	if (past_results.size() == previous_measurements)
-//		return;
+/*
+ * Fit all_parameters to past_results in one go. Returns false, leaving
+ * the parameters alone, when the answer is not better than what we have;
+ * some devices are only piecewise linear, and then the hill climber gets
+ * to try.
+ */
+bool fit_parameters(unsigned int bpi)
+{
+	struct parameter_bundle fitted;
+	struct linear_model model;
+	vector<unsigned int> live;
+	vector<double> g, h, x, upper;
+	vector<bool> fixed;
+	double old_error, new_error, ridge = 0;
+	struct timespec begin, end;
+	unsigned int r, i, j, k, m;
+
+	clock_gettime(CLOCK_MONOTONIC, &begin);
+
+	rls.valid = false;
+	build_model(&model, bpi);
+
+	/* parameters no device reacts to (base power among them) are left as they are */
+	for (j = 1; j < model.cols; j++) {
+		for (r = 0; r < model.rows; r++)
+			if (model.usage[r * model.cols + j] != 0.0)
+				break;
+		if (r < model.rows)
+			live.push_back(j);
+	}
+	m = live.size();
+
+	/* normal equations, each result weighted by its power */
+	g.assign(m * m, 0.0);
+	h.assign(m, 0.0);
+	for (r = 0; r < model.rows; r++) {
+		double w = past_results[r]->power;
+		double t = past_results[r]->power - model.offset[r];
+		const double *row = &model.usage[r * model.cols];
+
+		for (i = 0; i < m; i++) {
+			if (row[live[i]] == 0.0)
+				continue;
+			h[i] += w * row[live[i]] * t;
+			for (k = 0; k < m; k++)
+				g[i * m + k] += w * row[live[i]] * row[live[k]];
+		}
+	}
 
-	precompute_valid();
+	/*
+	 * A little pull towards the current values: combinations of parameters
+	 * the results cannot tell apart (devices whose utilization never
+	 * changed) stay where they were instead of going anywhere.
+	 */
+	for (i = 0; i < m; i++)
+		ridge += g[i * m + i];
+	ridge = ridge / (m + 1) * 1e-6 + 1e-12;
+	for (i = 0; i < m; i++) {
+		g[i * m + i] += ridge;
+		h[i] += ridge * all_parameters.parameters[live[i]];
+	}
 
+	upper.assign(m, PARAM_MAX);
 
-	previous_measurements = past_results.size();
+	/* pin the worst one over its limit there and solve again, until none is */
+	x.assign(m, 0.0);
+	fixed.assign(m, false);
+	for (k = 0; k <= m; k++) {
+		unsigned int worst = m;
+		double over = 0;
 
-	double delta = 0.50;
+		nnls(g, h, m, fixed, x);
+		for (i = 0; i < m; i++)
+			if (!fixed[i] && x[i] - upper[i] > over) {
+				over = x[i] - upper[i];
+				worst = i;
+			}
+		if (worst == m)
+			break;
+		fixed[worst] = true;
+		x[worst] = upper[worst];
+	}
 
-	best_so_far = &all_parameters;
+	fitted = all_parameters;
+	for (i = 0; i < m; i++)
+		fitted.parameters[live[i]] = x[i];
 
-	if (!bpi)
-		bpi = get_param_index("base power");
+	/* judged the way the climber judges its steps */
+	old_error = calculate_params(&all_parameters);
+	new_error = calculate_params(&fitted);
+
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	if (debug_learning)
+		printf("NNLS fit of %u parameters to %u results: error %4.2f -> %4.2f in %5.2f ms\n",
+			m, model.rows, old_error / model.rows, new_error / model.rows,
+			(end.tv_sec - begin.tv_sec) * 1000.0 + (end.tv_nsec - begin.tv_nsec) / 1000000.0);
+
+	if (new_error > old_error)
+		return false;
+
+	all_parameters.parameters = fitted.parameters;
+	all_parameters.score = new_error;
+
+	/* g is done with; start_rls() factors it in place */
+	start_rls(live, g, x, upper);
+	return true;
+}
+
+/*
+ * One retry of the hill climber below tries, for every parameter, a step
+ * up, a step down, and (at random) zero, each on top of the same
+ * best_so_far. Those are independent, so all of them that the retry could
+ * possibly ask for are scored up front by a few threads, each on its own
+ * copy of the bundle; the climber then walks its usual path and takes the
+ * scores from here. Every score is still summed by one thread in result
+ * order, and the rand() calls stay in the main thread, so what it learns
+ * does not depend on the number of threads.
+ *
+ * Base power is never part of the score (compute_bundle() overwrites it),
+ * which is why it is left out here and kept serial in the climber.
+ */
+enum candidate_kind {
+	CANDIDATE_UP = 0,
+	CANDIDATE_DOWN,
+	CANDIDATE_ZERO,
+	CANDIDATE_KINDS
+};
+
+struct candidate {
+	bool		wanted;
+	unsigned int	param;
+	double		value;
+	double		score;
+	double		power;		/* guessed_power calculate_params() left behind */
+};
+
+static vector<struct candidate> candidates;	/* param * CANDIDATE_KINDS + kind */
+static struct parameter_bundle *candidate_base;
+static std::atomic<unsigned int> next_candidate;
+
+static void score_some(void)
+{
+	struct parameter_bundle bundle = *candidate_base;
+	unsigned int i;
+	double org;
+
+	while ((i = next_candidate++) < candidates.size()) {
+		struct candidate *c = &candidates[i];
+
+		if (!c->wanted)
+			continue;
+		org = bundle.parameters[c->param];
+		bundle.parameters[c->param] = c->value;
+		c->score = calculate_params(&bundle);
+		c->power = bundle.guessed_power;
+		bundle.parameters[c->param] = org;
+	}
+}
+
+/*
+ * The threads that help score_candidates(), started once per hill_climb()
+ * rather than per retry: a retry only scores a few hundred candidates, so
+ * creating threads for each would cost about as much as it saves. Each
+ * round bumps pool.round, and the caller waits until every worker has
+ * run out of candidates.
+ */
+static struct score_pool {
+	pt_mutex_t		lock;
+	pt_cond_t		work;
+	pt_cond_t		done;
+	vector<pt_thread_t>	threads;
+	unsigned int		round;
+	unsigned int		busy;
+	bool			stop;
+} pool;
+
+static void *score_worker(void *arg)
+{
+	unsigned int seen = 0;
+
+	pt_mutex_lock(&pool.lock);
+	while (1) {
+		while (!pool.stop && pool.round == seen)
+			pt_cond_wait(&pool.work, &pool.lock);
+		if (pool.stop)
+			break;
+		seen = pool.round;
+		pt_mutex_unlock(&pool.lock);
+
+		score_some();
+
+		pt_mutex_lock(&pool.lock);
+		if (--pool.busy == 0)
+			pt_cond_broadcast(&pool.done);
+	}
+	pt_mutex_unlock(&pool.lock);
+	return NULL;
+}
+
+/* returns the number of threads scoring, the caller included */
+static unsigned int start_score_pool(unsigned int params)
+{
+	unsigned long workers;
+	long nprocs;
+	unsigned int i;
+
+	/* a thread is only worth it for a few candidates' worth of results */
+	nprocs = platform_get_cpu_count();
+	workers = (unsigned long)params * CANDIDATE_KINDS * past_results.size() / 2000 + 1;
+	if (nprocs > 0 && workers > (unsigned long)nprocs)
+		workers = nprocs;
+
+	pt_mutex_init(&pool.lock);
+	pt_cond_init(&pool.work);
+	pt_cond_init(&pool.done);
+	pool.threads.clear();
+	pool.round = 0;
+	pool.busy = 0;
+	pool.stop = false;
+
+	for (i = 1; i < workers; i++) {
+		pt_thread_t thread;
+
+		if (pt_thread_create(&thread, score_worker, NULL) == 0)
+			pool.threads.push_back(thread);
+	}
+	return pool.threads.size() + 1;
+}
+
+static void stop_score_pool(void)
+{
+	unsigned int i;
+
+	pt_mutex_lock(&pool.lock);
+	pool.stop = true;
+	pt_cond_broadcast(&pool.work);
+	pt_mutex_unlock(&pool.lock);
+
+	for (i = 0; i < pool.threads.size(); i++)
+		pt_thread_join(pool.threads[i]);
+	pool.threads.clear();
+
+	pt_cond_destroy(&pool.done);
+	pt_cond_destroy(&pool.work);
+	pt_mutex_destroy(&pool.lock);
+}
+
+static void want_candidate(unsigned int param, int kind, double value)
+{
+	struct candidate *c = &candidates[param * CANDIDATE_KINDS + kind];
+
+	c->wanted = true;
+	c->param = param;
+	c->value = value;
+}
+
+/* the step down as the climber computes it, before try_zero() */
+static double step_down(double orgvalue, double weight)
+{
+	double value = orgvalue * 1 / (1 + weight);
+
+	if (value < 0.0001)
+		value = 0.0;
+	if (value > 5000)
+		value = 5000;
+	return value;
+}
+
+static double step_up(double orgvalue, double weight)
+{
+	double value;
+
+	if (orgvalue <= 0.001)
+		value = 0.1;
+	else
+		value = orgvalue * (1 + weight);
+	if (value > 5000)
+		value = 5000;
+	return value;
+}
+
+/*
+ * best_so_far has to have been through calculate_params() already: that
+ * builds the power model and result matrix, and lets the devices look up
+ * their indices, so that the workers only read shared state.
+ */
+static unsigned int score_candidates(struct parameter_bundle *best_so_far, double delta,
+				     unsigned int bpi)
+{
+	unsigned int i, n = best_so_far->parameters.size();
+	unsigned int wanted = 0;
+
+	candidates.assign(n * CANDIDATE_KINDS, candidate());
+	for (i = 1; i < n; i++) {
+		double weight = delta * best_so_far->weights[i];
+		double orgvalue = best_so_far->parameters[i];
+		double down;
+
+		if (i == bpi)
+			continue;
+
+		want_candidate(i, CANDIDATE_UP, step_up(orgvalue, weight));
+		down = step_down(orgvalue, weight);
+		if (down != orgvalue)
+			want_candidate(i, CANDIDATE_DOWN, down);
+		if (down != 0.0 && orgvalue != 0.0)
+			want_candidate(i, CANDIDATE_ZERO, 0.0);
+	}
+	for (i = 0; i < candidates.size(); i++)
+		if (candidates[i].wanted)
+			wanted++;
+
+	candidate_base = best_so_far;
+	next_candidate = 0;
+
+	pt_mutex_lock(&pool.lock);
+	pool.busy = pool.threads.size();
+	pool.round++;
+	pt_cond_broadcast(&pool.work);
+	pt_mutex_unlock(&pool.lock);
+
+	score_some();
+
+	pt_mutex_lock(&pool.lock);
+	while (pool.busy)
+		pt_cond_wait(&pool.done, &pool.lock);
+	pt_mutex_unlock(&pool.lock);
+	return wanted;
+}
+
+/* what calculate_params() would have done to best_so_far for this candidate */
+static void take_candidate(struct parameter_bundle *best_so_far, unsigned int param, int kind,
+			   unsigned int bpi)
+{
+	struct candidate *c = &candidates[param * CANDIDATE_KINDS + kind];
+
+	best_so_far->score = c->score;
+	best_so_far->guessed_power = c->power;
+	best_so_far->parameters[bpi] = c->power;
+}
+
+/*
+ * The old learner: walk one parameter at a time up or down by delta,
+ * whichever step helps most, until no step does. Only used when the
+ * linear fit is no better than what we have, and in --debug to compare
+ * the two.
+ */
+void hill_climb(struct parameter_bundle *best_so_far, int iterations, int do_base_power,
+		unsigned int bpi)
+{
+	double best_score = 10000000000000000.0;
+	int retry = iterations;
+	int prevparam = -1;
+	int locked = 0;
+	unsigned int i, workers = 1;
+	unsigned long scored = 0;
+	time_t start;
+	double delta = 0.50;
 
 	calculate_params(best_so_far);
 	best_score = best_so_far->score;
@@ -159,6 +778,7 @@ void learn_parameters(int iterations, int do_base_power)
 		best_so_far->parameters[bpi] = best_so_far->parameters[bpi] * 0.9998;
 
 	start = time(NULL);
+	workers = start_score_pool(best_so_far->parameters.size());
 
 	while (retry--) {
 		int changed  = 0;
@@ -166,6 +786,7 @@ void learn_parameters(int iterations, int do_base_power)
 		double newvalue = 0;
 		double orgscore;
 		double weight;
+		int kind;
 
 		bestparam = -1;
 
@@ -176,16 +797,15 @@ void learn_parameters(int iterations, int do_base_power)
 		orgscore = best_score = best_so_far->score;
 
 
+		scored += score_candidates(best_so_far, delta, bpi);
+
 	        for (i = 1; i < best_so_far->parameters.size(); i++) {
 			double value, orgvalue;
 
 			weight = delta * best_so_far->weights[i];
 
 			orgvalue = value = best_so_far->parameters[i];
-			if (value <= 0.001) {
-				value = 0.1;
-			} else
-				value = value * (1 + weight);
+			value = step_up(value, weight);
 
 			if (i == bpi && value > min_power)
 				value = min_power;
@@ -193,13 +813,13 @@ void learn_parameters(int iterations, int do_base_power)
 			if (i == bpi && orgvalue > min_power)
 				orgvalue = min_power;
 
-			if (value > 5000)
-				value = 5000;
-
 //			printf("Trying %s %4.2f -> %4.2f\n", param.c_str(), best_so_far->parameters[param], value);
-			best_so_far->parameters[i] = value;
+			if (i == bpi) {
+				best_so_far->parameters[i] = value;
+				calculate_params(best_so_far);
+			} else
+				take_candidate(best_so_far, i, CANDIDATE_UP, bpi);
 
-			calculate_params(best_so_far);
 			if (best_so_far->score < best_score || random_disturb(retry)) {
 				best_score = best_so_far->score;
 				newvalue = value;
@@ -207,25 +827,23 @@ void learn_parameters(int iterations, int do_base_power)
 				changed++;
 			}
 
-			value = orgvalue * 1 / (1 + weight);
-
-			if (value < 0.0001)
-				value = 0.0;
+			value = step_down(orgvalue, weight);
+			kind = CANDIDATE_DOWN;
 
-			if (try_zero(value))
+			if (try_zero(value)) {
+				if (value != 0.0)
+					kind = CANDIDATE_ZERO;
 				value = 0.0;
-
-
-			if (value > 5000)
-				value = 5000;
-
+			}
 
 //			printf("Trying %s %4.2f -> %4.2f\n", param.c_str(), orgvalue, value);
 
 			if (orgvalue != value) {
-				best_so_far->parameters[i] = value;
-
-				calculate_params(best_so_far);
+				if (i == bpi) {
+					best_so_far->parameters[i] = value;
+					calculate_params(best_so_far);
+				} else
+					take_candidate(best_so_far, i, kind, bpi);
 
 				if (best_so_far->score + 0.00001 < best_score || (random_disturb(retry) && value > 0.0)) {
 					best_score = best_so_far->score;
@@ -269,14 +887,139 @@ void learn_parameters(int iterations, int do_base_power)
 		if (retry % 50 == 49)
 			weed_empties(best_so_far);
 	}
+	stop_score_pool();
 
 
 	/* now we weed out all parameters that don't have value */
 	if (iterations > 50)
 		weed_empties(best_so_far);
 
+	if (debug_learning)
+		printf("Scored %lu candidates on %u threads\n", scored, workers);
 	if (debug_learning)
 		printf("Final score %4.2f (%i points)\n", best_so_far->score / past_results.size(), (int)past_results.size());
 //	dump_parameter_bundle(best_so_far);
 //	dump_past_results();
 }
+
+/* leaks like a sieve */
+void learn_parameters(int iterations, int do_base_power)
+{
+	struct parameter_bundle compare;
+	struct timespec begin, end;
+	static unsigned int bpi = 0;
+
+	/* don't start fitting anything until we have at least 1 more measurement than we have parameters */
+	if (past_results.size() <= all_parameters.parameters.size())
+		return;
+
+
+
+//	if (past_results.size() == previous_measurements)
+//		return;
+
+	precompute_valid();
+
+
+	previous_measurements = past_results.size();
+
+	if (!bpi)
+		bpi = get_param_index("base power");
+
+	if (debug_learning)
+		compare = all_parameters;
+
+	if (!fit_parameters(bpi)) {
+		hill_climb(&all_parameters, iterations, do_base_power, bpi);
+		return;
+	}
+
+	/* what the climber would have made of the same results, and how long it takes */
+	if (debug_learning) {
+		clock_gettime(CLOCK_MONOTONIC, &begin);
+		hill_climb(&compare, iterations, do_base_power, bpi);
+		clock_gettime(CLOCK_MONOTONIC, &end);
+		printf("Hill climber, %i iterations: error %4.2f in %5.2f ms, NNLS fit: error %4.2f\n",
+			iterations, compare.score / past_results.size(),
+			(end.tv_sec - begin.tv_sec) * 1000.0 + (end.tv_nsec - begin.tv_nsec) / 1000000.0,
+			calculate_params(&all_parameters) / past_results.size());
+	}
+}
+
+static void rls_update(struct result_bundle *result, unsigned int bpi)
+{
+	struct parameter_bundle probe;
+	vector<struct power_term> terms;
+	vector<class device *> other;
+	vector<double> row, x, px;
+	unsigned int i, j, m = rls.live.size();
+	double offset, denom, error;
+
+	if (result->power <= 0)
+		return;
+
+	power_model_terms(terms, other);
+	probe.parameters.assign(rls.params, 0.0);
+	probe.weights = all_parameters.weights;
+	row.resize(rls.params);
+	offset = model_row(result, terms, other, &probe, bpi, &row[0]);
+
+	x.resize(m);
+	for (i = 0; i < m; i++)
+		x[i] = row[rls.live[i]];
+
+	px.assign(m, 0.0);
+	denom = RLS_FORGET / result->power;
+	error = result->power - offset;
+	for (i = 0; i < m; i++) {
+		for (j = 0; j < m; j++)
+			px[i] += rls.p[i * m + j] * x[j];
+		denom += x[i] * px[i];
+		error -= x[i] * rls.theta[i];
+	}
+
+	for (i = 0; i < m; i++) {
+		rls.theta[i] += px[i] / denom * error;
+		for (j = 0; j < m; j++)
+			rls.p[i * m + j] = (rls.p[i * m + j] - px[i] * px[j] / denom) / RLS_FORGET;
+	}
+
+	/* the same box as the full fit */
+	for (i = 0; i < m; i++) {
+		if (rls.theta[i] < 0)
+			rls.theta[i] = 0;
+		if (rls.theta[i] > rls.upper[i])
+			rls.theta[i] = rls.upper[i];
+		all_parameters.parameters[rls.live[i]] = rls.theta[i];
+	}
+
+	if (debug_learning)
+		printf("RLS update %u of %u parameters: residual %4.2f W\n", rls.updates + 1, m, error);
+}
+
+/*
+ * Called once per measurement interval: fold the newest result into the
+ * parameters, and every RLS_REFIT intervals (or when there is no fit to
+ * update yet) learn them from all of past_results again. The full fit
+ * also shows how far the updates had drifted from it.
+ */
+void update_parameters(void)
+{
+	static unsigned int bpi = 0;
+
+	if (!bpi)
+		bpi = get_param_index("base power");
+
+	if (rls.valid && rls.params == all_parameters.parameters.size() && rls.updates < RLS_REFIT) {
+		if (newest_result && newest_result != rls.last) {
+			precompute_valid();
+			rls_update(newest_result, bpi);
+			rls.updates++;
+		}
+		rls.last = newest_result;
+		return;
+	}
+
+	learn_parameters(15, 0);
+	rls.last = newest_result;
+}
@@ -37,6 +37,7 @@ struct parameter_bundle all_parameters;
 struct result_bundle all_results;
 
 vector <struct result_bundle *> past_results;
+struct result_bundle *newest_result;
 
 map <string, int> param_index;
 static int maxindex = 1;
@@ -179,18 +180,197 @@ void report_utilization(int index, double value, struct result_bundle *bundle)
 
 
 
-double compute_bundle(struct parameter_bundle *parameters, struct result_bundle *results)
+/*
+ * compute_bundle() and bundle_power() run for every candidate parameter
+ * vector against every stored result. The devices that can list their
+ * power as power_terms are compiled into one table, grouped (CSR) by
+ * result index, so that
+ *
+ *	coefficient[res] = sum over the terms t in row res of scale_t * parameter[param_t]
+ *	power            = sum over res of coefficient[res] * utilization[res]
+ *
+ * and only the other devices still get power_usage() called.
+ */
+struct power_model {
+	bool			built;
+	unsigned int		devices;	/* all_devices.size() it was built for */
+	unsigned int		params;		/* all_parameters.parameters.size() */
+	vector<unsigned int>	row_start;	/* per result index, into param[] and scale[] */
+	vector<int>		param;
+	vector<double>		scale;
+	vector<class device *>	other;		/* devices without power_terms() */
+};
+
+static struct power_model all_model;		/* every device, as compute_bundle() */
+static struct power_model valid_model;		/* cached_valid ones, as bundle_power() */
+
+static void build_power_model(struct power_model *model, bool valid_only)
 {
+	vector<struct power_term> terms;
+	vector<unsigned int> count;
+	unsigned int i, rows = 0;
+
+	model->other.clear();
+	for (i = 0; i < all_devices.size(); i++) {
+		if (valid_only && !all_devices[i]->cached_valid)
+			continue;
+		if (!all_devices[i]->power_terms(terms))
+			model->other.push_back(all_devices[i]);
+	}
+
+	/* what get_parameter_value() and get_result_value() would make 0 */
+	for (i = 0; i < terms.size(); ) {
+		if (terms[i].param < 0 || terms[i].param >= (int)all_parameters.parameters.size() ||
+		    terms[i].result < 0) {
+			terms[i] = terms.back();
+			terms.pop_back();
+			continue;
+		}
+		if (terms[i].result + 1 > (int)rows)
+			rows = terms[i].result + 1;
+		i++;
+	}
+
+	count.assign(rows + 1, 0);
+	for (i = 0; i < terms.size(); i++)
+		count[terms[i].result + 1]++;
+	for (i = 0; i < rows; i++)
+		count[i + 1] += count[i];
+	model->row_start = count;
+
+	model->param.resize(terms.size());
+	model->scale.resize(terms.size());
+	for (i = 0; i < terms.size(); i++) {
+		unsigned int pos = count[terms[i].result]++;
+
+		model->param[pos] = terms[i].param;
+		model->scale[pos] = terms[i].scale;
+	}
+
+	model->devices = all_devices.size();
+	model->params = all_parameters.parameters.size();
+	model->built = true;
+}
+
+static struct power_model *get_power_model(struct power_model *model, bool valid_only)
+{
+	if (!model->built || model->devices != all_devices.size() ||
+	    model->params != all_parameters.parameters.size())
+		build_power_model(model, valid_only);
+	return model;
+}
+
+static void model_coefficients(struct power_model *model, struct parameter_bundle *bundle, vector<double> &coefficient)
+{
+	unsigned int res, k;
+
+	coefficient.assign(model->row_start.size() - 1, 0.0);
+	for (res = 0; res + 1 < model->row_start.size(); res++)
+		for (k = model->row_start[res]; k < model->row_start[res + 1]; k++)
+			if (model->param[k] < (int)bundle->parameters.size())
+				coefficient[res] += model->scale[k] * bundle->parameters[model->param[k]];
+}
+
+static double model_power(struct power_model *model, struct parameter_bundle *bundle, struct result_bundle *results)
+{
+	vector<double> coefficient;
 	double power = 0;
 	unsigned int i;
 
+	model_coefficients(model, bundle, coefficient);
+	for (i = 0; i < coefficient.size(); i++)
+		if (coefficient[i] != 0.0)
+			power += coefficient[i] * get_result_value(i, results);
+
+	for (i = 0; i < model->other.size(); i++)
+		power += model->other[i]->power_usage(results, bundle);
+	return power;
+}
+
+/*
+ * past_results, one row per result index and one column per result, so
+ * that the row of a coefficient is a contiguous run. Rebuilt whenever
+ * past_results holds different bundles than last time.
+ */
+static vector<double> result_matrix;
+static vector<struct result_bundle *> matrix_results;
+static unsigned int matrix_rows;
+
+static void update_result_matrix(unsigned int rows)
+{
+	unsigned int res, r, n = past_results.size();
+
+	if (rows <= matrix_rows && matrix_results == past_results)
+		return;
+
+	matrix_results = past_results;
+	matrix_rows = max(rows, matrix_rows);
+	result_matrix.assign((size_t)matrix_rows * n, 0.0);
+	for (r = 0; r < n; r++)
+		for (res = 0; res < matrix_rows && res < past_results[r]->utilization.size(); res++)
+			result_matrix[(size_t)res * n + r] = past_results[r]->utilization[res];
+}
+
+/*
+ * The device power (no base power) of every one of past_results, as
+ * compute_bundle() would find it for each.
+ */
+void past_results_power(struct parameter_bundle *parameters, vector<double> &power)
+{
+	struct power_model *model = get_power_model(&all_model, false);
+	vector<double> coefficient;
+	unsigned int res, r, i, n = past_results.size();
+
+	model_coefficients(model, parameters, coefficient);
+	update_result_matrix(coefficient.size());
+
+	power.assign(n, 0.0);
+	if (!n)
+		return;
+
+	for (res = 0; res < coefficient.size(); res++) {
+		const double *util = &result_matrix[(size_t)res * n];
+		double c = coefficient[res];
+
+		if (c == 0.0)
+			continue;
+		for (r = 0; r < n; r++)
+			power[r] += c * util[r];
+	}
+
+	for (i = 0; i < model->other.size(); i++)
+		for (r = 0; r < n; r++)
+			power[r] += model->other[i]->power_usage(past_results[r], parameters);
+}
+
+/* the table behind past_results_power(), for the parameter fitting */
+void power_model_terms(vector<struct power_term> &terms, vector<class device *> &other)
+{
+	struct power_model *model = get_power_model(&all_model, false);
+	struct power_term term;
+	unsigned int res, k;
+
+	terms.clear();
+	for (res = 0; res + 1 < model->row_start.size(); res++)
+		for (k = model->row_start[res]; k < model->row_start[res + 1]; k++) {
+			term.param = model->param[k];
+			term.result = res;
+			term.scale = model->scale[k];
+			terms.push_back(term);
+		}
+	other = model->other;
+}
+
+double compute_bundle(struct parameter_bundle *parameters, struct result_bundle *results)
+{
+	double power = 0;
+
 	static int bpi = 0;
 
 	if (!bpi)
 		bpi = get_param_index("base power");
 
-	for (i = 0; i < all_devices.size(); i++)
-		power += all_devices[i]->power_usage(results, parameters);
+	power = model_power(get_power_model(&all_model, false), parameters, results);
 
 	parameters->actual_power = results->power;
 	parameters->guessed_power = power;
@@ -210,12 +390,15 @@ void precompute_valid(void)
 		all_devices[i]->cached_valid = all_devices[i]->power_valid();
 	}
 	precomputed_valid = 1;
+
+	/* usb devices, for one, list their terms according to cached_valid */
+	all_model.built = false;
+	valid_model.built = false;
 }
 
 double bundle_power(struct parameter_bundle *parameters, struct result_bundle *results)
 {
 	double power = 0;
-	unsigned int i;
 	static int bpi = 0;
 
 	if (!bpi)
@@ -226,12 +409,7 @@ double bundle_power(struct parameter_bundle *parameters, struct result_bundle *r
 
 
 	power = parameters->parameters[bpi];
-
-	for (i = 0; i < all_devices.size(); i++) {
-
-		if (all_devices[i]->cached_valid)
-			power += all_devices[i]->power_usage(results, parameters);
-	}
+	power += model_power(get_power_model(&valid_model, true), parameters, results);
 
 	return power;
 }
@@ -334,8 +512,10 @@ void store_results(double duration)
 		if (past_results.size() >= MAX_PARAM) {
 			/* memory leak, must free old one first */
 			past_results[overflow_index] = clone_results(&all_results);
+			newest_result = past_results[overflow_index];
 		} else {
 			past_results.push_back(clone_results(&all_results));
+			newest_result = past_results.back();
 		}
 		if ((past_results.size() % 10) == 0)
 			save_all_results("saved_results.powertop");
@@ -453,6 +633,12 @@ char* get_param_directory(const char *filename)
 {
 	static char tempfilename[PATH_MAX];
 
+	/* a full path is taken as it is */
+	if (filename[0] == '/') {
+		snprintf(tempfilename, sizeof(tempfilename), "%s", filename);
+		return tempfilename;
+	}
+
 	if (access("/var/cache/powertop", W_OK ) == 0)
 		snprintf(tempfilename, sizeof(tempfilename), "/var/cache/powertop/%s", filename);
 	if (access("/data/local/powertop", W_OK ) == 0)
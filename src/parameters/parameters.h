@@ -73,6 +73,7 @@ struct result_bundle
 
 extern struct result_bundle all_results;
 extern vector <struct result_bundle *> past_results;
+extern struct result_bundle *newest_result;	/* the last one store_results() kept */
 
 extern double get_result_value(const char *name, struct result_bundle *bundle = &all_results);
 extern double get_result_value(int index, struct result_bundle *bundle = &all_results);
@@ -89,6 +90,8 @@ extern void report_utilization(int index, double value, struct result_bundle *bu
 extern void precompute_valid(void);
 
 extern double compute_bundle(struct parameter_bundle *parameters = &all_parameters, struct result_bundle *results = &all_results);
+extern void past_results_power(struct parameter_bundle *parameters, vector<double> &power);
+extern void power_model_terms(vector<struct power_term> &terms, vector<class device *> &other);
 
 
 void dump_parameter_bundle(struct parameter_bundle *patameters = &all_parameters);
@@ -99,6 +102,11 @@ extern struct parameter_bundle * clone_parameters(struct parameter_bundle *bundl
 
 extern void store_results(double duration);
 extern void learn_parameters(int iterations, int do_base_power);
+/* the two ways learn_parameters() learns, bpi is the index of "base power" */
+extern bool fit_parameters(unsigned int bpi);
+extern void hill_climb(struct parameter_bundle *best_so_far, int iterations, int do_base_power,
+		       unsigned int bpi);
+extern void update_parameters(void);
 extern char *get_param_directory(const char *filename);
 extern void save_all_results(const char *filename = "saved_results.powertop");
 extern void close_results(void);
@@ -42,6 +42,7 @@
 #endif
 
 #include "perf.h"
+#include "perf_capture.h"
 #include "../lib.h"
 #include "../display.h"
 
@@ -88,6 +89,10 @@ void perf_event::create_perf_event(char *eventname, int _cpu)
 	attr.inherit		= 0;
 	attr.disabled		= 1;
 
+	/* wake up pollers (the drain thread) once the ring is a quarter full */
+	attr.watermark		= 1;
+	attr.wakeup_watermark	= bufsize * getpagesize() / 4;
+
 	attr.type		= PERF_TYPE_TRACEPOINT;
 	attr.config		= trace_type;
 
@@ -116,10 +121,23 @@ void perf_event::create_perf_event(char *eventname, int _cpu)
 
 	fcntl(perf_fd, F_SETFL, O_NONBLOCK);
 
+	/*
+	 * Write our samples into the ring of another event on the same cpu
+	 * if we can; on kernels that refuse, fall back to our own ring.
+	 */
+	if (output && output->perf_fd >= 0 &&
+	    ioctl(perf_fd, PERF_EVENT_IOC_SET_OUTPUT, output->perf_fd) == 0) {
+		ret = ioctl(perf_fd, PERF_EVENT_IOC_ENABLE, 0);
+		if (ret < 0)
+			fprintf(stderr, "failed to enable perf \n");
+		return;
+	}
+
 	perf_mmap = mmap(NULL, (bufsize+1)*getpagesize(),
 				PROT_READ | PROT_WRITE, MAP_SHARED, perf_fd, 0);
 	if (perf_mmap == MAP_FAILED) {
 		fprintf(stderr, "failed to mmap with %d (%s)\n", errno, strerror(errno));
+		perf_mmap = NULL;
 		return;
 	}
 
@@ -140,6 +158,10 @@ static int parse_event_format(const char *system_name, const char *event_name)
 	char *buf;
 	int size;
 
+	/* a replay only knows the events that are in the capture */
+	if (replay_active())
+		return -1;
+
 	buf = tracefs_event_file_read(NULL, system_name, event_name, "format", &size);
 	if (!buf)
 		return -1;
@@ -183,7 +205,22 @@ void perf_event::set_cpu(int _cpu)
 	cpu = _cpu;
 }
 
-static void allocate_tep(void)
+/* share the ring buffer of leader (same cpu) instead of mapping our own */
+void perf_event::set_output(class perf_event *leader)
+{
+	output = leader;
+}
+
+/* ring size in pages, must be a power of two; takes effect on start() */
+void perf_event::set_buffer_size(int pages)
+{
+	/* a mapping has to be unmapped with the size it was made with */
+	if (perf_mmap && pages != bufsize)
+		clear();
+	bufsize = pages;
+}
+
+void perf_event::tep_get(void)
 {
 	if (!perf_event::tep)
 		perf_event::tep = tep_alloc();
@@ -191,25 +228,40 @@ static void allocate_tep(void)
 		tep_ref(perf_event::tep);
 }
 
+void perf_event::tep_put(void)
+{
+	if (!perf_event::tep)
+		return;
+	if (tep_get_ref(perf_event::tep) == 1) {
+		tep_free(perf_event::tep);
+		perf_event::tep = NULL;
+	} else
+		tep_unref(perf_event::tep);
+}
+
 perf_event::perf_event(const char *system_name, const char *event_name, int _cpu, int buffer_size)
 {
-	allocate_tep();
+	tep_get();
 	name = NULL;
 	perf_fd = -1;
 	bufsize = buffer_size;
 	cpu = _cpu;
 	perf_mmap = NULL;
+	pc = NULL;
+	output = NULL;
 	trace_type = 0;
 	set_event_name(system_name, event_name);
 }
 
 perf_event::perf_event(void)
 {
-	allocate_tep();
+	tep_get();
 	name = NULL;
 	perf_fd = -1;
 	bufsize = 128;
 	perf_mmap = NULL;
+	pc = NULL;
+	output = NULL;
 	cpu = 0;
 	trace_type = 0;
 }
@@ -222,6 +274,9 @@ void perf_event::start(void)
 void perf_event::stop(void)
 {
 	int ret;
+
+	if (perf_fd < 0)
+		return;
 	ret = ioctl(perf_fd, PERF_EVENT_IOC_DISABLE, 0);
 	if (ret)
 		cout << "stop failing\n";
@@ -231,7 +286,7 @@ void perf_event::process(void *cookie)
 {
 	struct perf_event_header *header;
 
-	if (perf_fd < 0)
+	if (perf_fd < 0 || !perf_mmap)
 		return;
 
 	while (pc->data_tail != pc->data_head ) {
@@ -254,12 +309,88 @@ void perf_event::process(void *cookie)
 	pc->data_tail = pc->data_head;
 }
 
+/*
+ * Number of bytes the kernel has written to the ring buffer that we have
+ * not consumed yet. data_head/data_tail are free running; only the
+ * offsets into the data pages wrap.
+ */
+unsigned long perf_event::pending_bytes(void)
+{
+	uint64_t head;
+
+	if (perf_fd < 0 || !perf_mmap)
+		return 0;
+
+	head = pc->data_head;
+	__sync_synchronize();
+
+	return head - pc->data_tail;
+}
+
+/*
+ * Copy len bytes (as returned by pending_bytes) out of the ring buffer in
+ * at most two memcpy()s and hand the space back to the kernel. Records
+ * that straddle the end of the ring come out contiguous in buffer.
+ */
+void perf_event::drain(unsigned char *buffer, unsigned long len)
+{
+	unsigned long size = ring_size();
+	unsigned long offset, first;
+
+	if (perf_fd < 0 || !perf_mmap || !len)
+		return;
+
+	offset = pc->data_tail & (size - 1);
+	first = len;
+	if (first > size - offset)
+		first = size - offset;
+
+	memcpy(buffer, (unsigned char *)data_mmap + offset, first);
+	if (len > first)
+		memcpy(buffer + first, data_mmap, len - first);
+
+	consume(len);
+}
+
+/*
+ * Raw access for readers that walk the ring buffer in place; positions
+ * are free running and have to be masked with ring_size() - 1, the ring
+ * is always a power of two pages.
+ */
+unsigned char *perf_event::ring_data(void)
+{
+	if (!perf_mmap)
+		return NULL;
+	return (unsigned char *)data_mmap;
+}
+
+unsigned long perf_event::ring_size(void)
+{
+	return (unsigned long)bufsize * getpagesize();
+}
+
+uint64_t perf_event::ring_tail(void)
+{
+	if (!perf_mmap)
+		return 0;
+	return pc->data_tail;
+}
+
+void perf_event::consume(unsigned long len)
+{
+	if (!perf_mmap)
+		return;
+	__sync_synchronize();
+	pc->data_tail += len;
+}
+
 void perf_event::clear(void)
 {
 	if (perf_mmap) {
 //		memset(perf_mmap, 0, (bufsize)*getpagesize());
 		munmap(perf_mmap, (bufsize+1)*getpagesize());
 		perf_mmap = NULL;
+		pc = NULL;
 	}
 	if (perf_fd != -1)
 		close(perf_fd);
@@ -26,6 +26,7 @@
 #define _INCLUDE_GUARD_PERF_H_
 
 #include <iostream>
+#include <stdint.h>
 
 #ifndef _WIN32
 extern "C" {
@@ -48,6 +49,7 @@ protected:
 	int bufsize;
 	char *name;
 	int cpu;
+	class perf_event *output;
 	void create_perf_event(char *eventname, int cpu);
 
 public:
@@ -61,6 +63,10 @@ public:
 
 	void set_event_name(const char *system_name, const char *event_name);
 	void set_cpu(int cpu);
+	int get_cpu(void) { return cpu; }
+	int get_fd(void) { return perf_fd; }
+	void set_output(class perf_event *leader);
+	void set_buffer_size(int pages);
 
 	void start(void);
 	void stop(void);
@@ -68,9 +74,19 @@ public:
 
 	void process(void *cookie);
 
+	unsigned long pending_bytes(void);
+	void drain(unsigned char *buffer, unsigned long len);
+
+	unsigned char *ring_data(void);
+	unsigned long ring_size(void);
+	uint64_t ring_tail(void);
+	void consume(unsigned long len);
+
 	virtual void handle_event(struct perf_event_header *header, void *cookie) { };
 
 	static struct tep_handle *tep;
+	static void tep_get(void);
+	static void tep_put(void);
 
 };
 #else /* _WIN32 */
@@ -83,10 +99,20 @@ public:
 	virtual ~perf_event(void) {}
 	void set_event_name(const char *, const char *) {}
 	void set_cpu(int) {}
+	int get_cpu(void) { return 0; }
+	int get_fd(void) { return -1; }
+	void set_output(class perf_event *) {}
+	void set_buffer_size(int) {}
 	void start(void) {}
 	void stop(void) {}
 	void clear(void) {}
 	void process(void *) {}
+	unsigned long pending_bytes(void) { return 0; }
+	void drain(unsigned char *, unsigned long) {}
+	unsigned char *ring_data(void) { return NULL; }
+	unsigned long ring_size(void) { return 0; }
+	uint64_t ring_tail(void) { return 0; }
+	void consume(unsigned long) {}
 	virtual void handle_event(void *, void *) {}
 };
 #endif /* _WIN32 */
@@ -26,53 +26,230 @@
 #include <algorithm>
 #include <string.h>
 #include <stdint.h>
+#include <stdlib.h>
 #include <stdio.h>
+#include <errno.h>
 
 #include "perf_bundle.h"
+#include "perf_capture.h"
 #include "perf.h"
 
 #include "../cpu/cpu.h"
 
+int perf_background_drain = 0;
+int perf_ring_min_pages = 8;
+int perf_ring_max_pages = 1024;
+
+perf_arena::perf_arena(size_t _chunk_size)
+{
+	current = 0;
+	used = 0;
+	chunk_size = _chunk_size;
+	allocations = 0;
+	bytes = 0;
+	chunk_allocs = 0;
+}
+
+perf_arena::~perf_arena(void)
+{
+	release();
+}
+
+void *perf_arena::alloc(size_t size)
+{
+	struct chunk c;
+	void *ptr;
+
+	/* perf records are u64 aligned, keep them that way */
+	size = (size + 7) & ~(size_t)7;
+
+	while (current < chunks.size()) {
+		if (used + size <= chunks[current].size)
+			break;
+		current++;
+		used = 0;
+	}
+
+	if (current >= chunks.size()) {
+		c.size = size > chunk_size ? size : chunk_size;
+		c.data = (unsigned char *)malloc(c.size);
+		if (!c.data)
+			return NULL;
+		chunks.push_back(c);
+		chunk_allocs++;
+		current = chunks.size() - 1;
+		used = 0;
+	}
+
+	ptr = chunks[current].data + used;
+	used += size;
+	allocations++;
+	bytes += size;
+	return ptr;
+}
+
+void perf_arena::reset(void)
+{
+	current = 0;
+	used = 0;
+	allocations = 0;
+	bytes = 0;
+}
+
+void perf_arena::release(void)
+{
+	unsigned int i;
+
+	for (i = 0; i < chunks.size(); i++)
+		free(chunks[i].data);
+	chunks.clear();
+	reset();
+}
+
+size_t perf_arena::capacity(void)
+{
+	unsigned int i;
+	size_t total = 0;
+
+	for (i = 0; i < chunks.size(); i++)
+		total += chunks[i].size;
+	return total;
+}
+
 #ifndef _WIN32
 #include <malloc.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <fcntl.h>
 #include <unistd.h>
+#include <sys/epoll.h>
 #ifndef _WIN32
 #include "perf_event.h"
 #endif
 
-#if defined(__GXX_EXPERIMENTAL_CXX0X__) || (__cplusplus >= 201103L)
-# define USE_DECLTYPE
-#endif
+extern int debug_learning;
+
+/* all live bundles, so lost samples can be reported across them */
+static vector<class perf_bundle *> all_bundles;
+
+static void *perf_drain_thread(void *arg);
+
+/* a power of two within perf_ring_min_pages..perf_ring_max_pages */
+static int clamp_ring_pages(int pages)
+{
+	int min = 1, max = 1;
+
+	while (min < perf_ring_min_pages)
+		min *= 2;
+	while (max * 2 <= perf_ring_max_pages)
+		max *= 2;
+	if (max < min)
+		max = min;
+
+	if (pages < min)
+		return min;
+	if (pages > max)
+		return max;
+	while (pages & (pages - 1))
+		pages &= pages - 1;
+	return pages;
+}
 
 class perf_bundle_event: public perf_event
 {
 public:
 	perf_bundle_event(void);
-	virtual void handle_event(struct perf_event_header *header, void *cookie);
 };
 
 perf_bundle_event::perf_bundle_event(void) : perf_event()
 {
 }
 
+perf_bundle::perf_bundle(void)
+{
+	type_field.offset = -1;
+	type_field.size = 0;
+	type_field.string = false;
+	type_field.dynamic = false;
+	drain_stop = false;
+	drain_running = false;
+	running = false;
+	processed = false;
+	all_bundles.push_back(this);
+}
+
+perf_bundle::~perf_bundle()
+{
+	unsigned int i;
+
+	for (i = 0; i < all_bundles.size(); i++)
+		if (all_bundles[i] == this) {
+			all_bundles.erase(all_bundles.begin() + i);
+			break;
+		}
+}
 
-void perf_bundle_event::handle_event(struct perf_event_header *header, void *cookie)
+static void resolve_field(struct tep_event *event, const char *name, struct trace_field *field)
 {
-	unsigned char *buffer;
-	vector<void *> *vector;
+	struct tep_format_field *format;
 
-	buffer = (unsigned char *)malloc(header->size);
-	memcpy(buffer, header, header->size);
+	field->offset = -1;
+	field->size = 0;
+	field->string = false;
+	field->dynamic = false;
 
-#ifdef USE_DECLTYPE
-	vector = (decltype(vector))cookie;
-#else
-	vector = (typeof(vector))cookie;
-#endif
-	vector->push_back(buffer);
+	format = tep_find_any_field(event, name);
+	if (!format)
+		return;
+
+	field->offset = format->offset;
+	field->size = format->size;
+	field->string = (format->flags & TEP_FIELD_IS_STRING) != 0;
+	field->dynamic = (format->flags & TEP_FIELD_IS_DYNAMIC) != 0;
+}
+
+class trace_decoder *perf_bundle::create_decoder(unsigned int id, trace_handler handler,
+						 const char * const *fields)
+{
+	class trace_decoder *decoder;
+	struct tep_event *event;
+	unsigned int i;
+
+	event = tep_find_event(perf_event::tep, id);
+	if (!event)
+		return NULL;
+
+	/* common_type sits at the same place in every event */
+	if (type_field.offset < 0)
+		resolve_field(event, "common_type", &type_field);
+
+	if (decoders.size() <= id)
+		decoders.resize(id + 1, NULL);
+
+	decoder = new class trace_decoder;
+	decoder->id = id;
+	decoder->name = event->name;
+	decoder->handler = handler;
+	decoder->next = NULL;
+	resolve_field(event, "cpu_id", &decoder->cpu_field);
+
+	for (i = 0; fields && fields[i]; i++) {
+		struct trace_field field;
+
+		resolve_field(event, fields[i], &field);
+		decoder->fields.push_back(field);
+	}
+
+	/* consumers see the event in the order they subscribed to it */
+	if (decoders[id]) {
+		class trace_decoder *last = decoders[id];
+
+		while (last->next)
+			last = last->next;
+		last->next = decoder;
+	} else
+		decoders[id] = decoder;
+	return decoder;
 }
 
 
@@ -81,6 +258,12 @@ void perf_bundle::release(void)
 	class perf_event *ev;
 	unsigned int i = 0;
 
+	if (drain_running) {
+		__atomic_store_n(&drain_stop, true, __ATOMIC_RELEASE);
+		pt_thread_join(drain_tid);
+		drain_running = false;
+	}
+
 	for (i = 0; i < events.size(); i++) {
 		ev = events[i];
 		if (!ev)
@@ -90,17 +273,37 @@ void perf_bundle::release(void)
 	}
 	events.clear();
 
-	for(i = 0; i < records.size(); i++) {
-		free(records[i]);
+	for (i = 0; i < decoders.size(); i++) {
+		while (decoders[i]) {
+			class trace_decoder *next = decoders[i]->next;
+
+			delete decoders[i];
+			decoders[i] = next;
+		}
 	}
-	records.clear();
+	decoders.clear();
+
+	drained.clear();
+	lost.clear();
+	consumers.clear();
+	running = false;
+	processed = false;
+
+	arena.release();
 }
 
-bool perf_bundle::add_event(const char *system_name, const char *event_name)
+/*
+ * Subscribe to a tracepoint on all cpus. If the event is already part of
+ * the bundle only the handler is added, the kernel side is shared. Events
+ * have to be added before start().
+ */
+bool perf_bundle::add_event(const char *system_name, const char *event_name,
+			    trace_handler handler, const char * const *fields)
 {
 	unsigned int i;
 	int event_added = false;
 	class perf_event *ev;
+	unsigned int id = 0;
 
 
 	for (i = 0; i < all_cpus.size(); i++) {
@@ -113,26 +316,121 @@ bool perf_bundle::add_event(const char *system_name, const char *event_name)
 		ev->set_event_name(system_name, event_name);
 		ev->set_cpu(i);
 
-		if ((int)ev->trace_type >= 0) {
-			events.push_back(ev);
-			event_added = true;
-		} else {
+		if ((int)ev->trace_type < 0) {
 			delete ev;
+			continue;
 		}
+
+		id = ev->trace_type;
+		event_added = true;
+		if (id < decoders.size() && decoders[id])
+			delete ev;
+		else
+			events.push_back(ev);
 	}
+
+	if (event_added)
+		create_decoder(id, handler, fields);
+
 	return event_added;
 }
 
+void perf_bundle::add_consumer(const struct trace_consumer *consumer)
+{
+	unsigned int i;
+
+	for (i = 0; i < consumers.size(); i++)
+		if (consumers[i] == consumer)
+			return;
+	consumers.push_back(consumer);
+}
+
 void perf_bundle::start(void)
 {
 	unsigned int i;
 	class perf_event *ev;
+	vector<class perf_event *> leaders;
+	vector<int> per_cpu;
+	int pages;
+
+	/* shared bundles get started by each of their consumers */
+	if (running)
+		return;
+	running = true;
+	processed = false;
+
+	/*
+	 * The lost counts of an interval are shown after process() and
+	 * clear() are done with it, so they only start over here.
+	 */
+	lost.clear();
+
+	/* a replay feeds the records from the capture, nothing to open */
+	if (replay_active())
+		return;
+
+	/*
+	 * One ring buffer per cpu: the first event on a cpu owns it and all
+	 * other events on that cpu write into it (PERF_EVENT_IOC_SET_OUTPUT).
+	 * That saves an fd-sized mmap per event and keeps each ring in time
+	 * order across events.
+	 */
+	for (i = 0; i < events.size(); i++) {
+		ev = events[i];
+		if (!ev)
+			continue;
+		if (leaders.size() <= (unsigned int)ev->get_cpu()) {
+			leaders.resize(ev->get_cpu() + 1, NULL);
+			per_cpu.resize(ev->get_cpu() + 1, 0);
+		}
+		if (!leaders[ev->get_cpu()])
+			leaders[ev->get_cpu()] = ev;
+		per_cpu[ev->get_cpu()]++;
+	}
+
+	if (ring_pages.size() < leaders.size()) {
+		ring_pages.resize(leaders.size(), 0);
+		ring_peak.resize(leaders.size(), 0);
+	}
+
+	for (i = 0; i < leaders.size(); i++) {
+		if (!leaders[i])
+			continue;
+		/*
+		 * The first time around the shared ring gets more room the more
+		 * events it carries; after that resize_rings() decides.
+		 */
+		pages = ring_pages[i];
+		if (!pages) {
+			pages = 128;
+			while (pages < 128 * per_cpu[i] && pages < 512)
+				pages *= 2;
+		}
+		pages = ring_pages[i] = clamp_ring_pages(pages);
+		leaders[i]->set_output(NULL);
+		leaders[i]->set_buffer_size(pages);
+		leaders[i]->start();
+	}
 
 	for (i = 0; i < events.size(); i++) {
 		ev = events[i];
 		if (!ev)
 			continue;
-		ev->start();
+		if (ev != leaders[ev->get_cpu()]) {
+			ev->set_output(leaders[ev->get_cpu()]);
+			ev->start();
+		}
+	}
+
+	drained.resize(events.size());
+	lost.resize(leaders.size(), 0);
+
+	if (perf_background_drain && !drain_running) {
+		__atomic_store_n(&drain_stop, false, __ATOMIC_RELEASE);
+		if (pt_thread_create(&drain_tid, perf_drain_thread, this) == 0)
+			drain_running = true;
+		else
+			fprintf(stderr, "perf: failed to start drain thread\n");
 	}
 }
 void perf_bundle::stop(void)
@@ -140,6 +438,16 @@ void perf_bundle::stop(void)
 	unsigned int i;
 	class perf_event *ev;
 
+	if (!running)
+		return;
+	running = false;
+
+	if (drain_running) {
+		__atomic_store_n(&drain_stop, true, __ATOMIC_RELEASE);
+		pt_thread_join(drain_tid);
+		drain_running = false;
+	}
+
 	for (i = 0; i < events.size(); i++) {
 		ev = events[i];
 		if (!ev)
@@ -160,10 +468,75 @@ void perf_bundle::clear(void)
 		ev->clear();
 	}
 
-	for (i = 0; i < records.size(); i++) {
-		free(records[i]);
+	for (i = 0; i < drained.size(); i++)
+		drained[i].clear();
+
+	arena.reset();
+}
+
+/*
+ * Move whatever is in the ring of events[i] into the arena so the kernel
+ * never runs out of space while the interval is still going on.
+ */
+void perf_bundle::drain_event(unsigned int i)
+{
+	struct perf_span span;
+
+	span.len = events[i]->pending_bytes();
+	if (!span.len)
+		return;
+
+	span.data = (unsigned char *)arena.alloc(span.len);
+	if (!span.data)
+		return;
+
+	events[i]->drain(span.data, span.len);
+	drained[i].push_back(span);
+
+	if (span.len > ring_peak[events[i]->get_cpu()])
+		ring_peak[events[i]->get_cpu()] = span.len;
+}
+
+void perf_bundle::drain_loop(void)
+{
+	struct epoll_event ev;
+	vector<struct epoll_event> ready;
+	unsigned int i;
+	int efd, n;
+
+	efd = epoll_create1(EPOLL_CLOEXEC);
+	if (efd < 0)
+		return;
+
+	/* only the events that own a ring buffer */
+	for (i = 0; i < events.size(); i++) {
+		if (!events[i] || !events[i]->ring_data())
+			continue;
+		ev.events = EPOLLIN;
+		ev.data.u32 = i;
+		epoll_ctl(efd, EPOLL_CTL_ADD, events[i]->get_fd(), &ev);
+	}
+	ready.resize(events.size() ? events.size() : 1);
+
+	while (!__atomic_load_n(&drain_stop, __ATOMIC_ACQUIRE)) {
+		n = epoll_wait(efd, &ready[0], ready.size(), 100);
+		if (n < 0) {
+			/* epoll_wait is never restarted after a signal */
+			if (errno == EINTR)
+				continue;
+			break;
+		}
+		for (i = 0; i < (unsigned int)n; i++)
+			drain_event(ready[i].data.u32);
 	}
-	records.resize(0);
+
+	close(efd);
+}
+
+static void *perf_drain_thread(void *arg)
+{
+	((class perf_bundle *)arg)->drain_loop();
+	return NULL;
 }
 
 
@@ -181,103 +554,382 @@ struct perf_sample {
 	unsigned char			data[0];
 } __attribute__((packed));
 
-static uint64_t timestamp(perf_event_header *event)
+/*
+ * sample's PERF_SAMPLE_CPU cpu nr is a raw_smp_processor_id() by the
+ * time of perf_event_output(), which may differ from struct perf_event
+ * cpu, thus we need to fix sample->trace.cpu. Whether the event has a
+ * cpu_id field, and where, was resolved when its decoder was created.
+ */
+static inline void fixup_sample_trace_cpu(struct perf_sample *sample, class trace_decoder *decoder)
 {
-	struct perf_sample *sample;
+	if (decoder && decoder->cpu_field.offset >= 0)
+		sample->trace.cpu = trace_decoder::load(&sample->data, decoder->cpu_field);
+}
 
-	if (event->type != PERF_RECORD_SAMPLE)
-		return 0;
-
-	sample = (struct perf_sample *)event;
-
-#if 0
-	int i;
-	unsigned char *x;
-
-	printf("header:\n");
-	printf("	type  is %x \n", sample->header.type);
-	printf("	misc  is %x \n", sample->header.misc);
-	printf("	size  is %i \n", sample->header.size);
-	printf("sample:\n");
-	printf("	time  is %llx \n", sample->trace.time);
-	printf("	cpu   is %i / %x \n", sample->trace.cpu, sample->trace.cpu);
-	printf("	res   is %i / %x \n", sample->trace.res, sample->trace.res);
-	printf("	size  is %i / %x \n", sample->trace.size, sample->trace.size);
-	printf("	type  is %i / %x \n", sample->trace.type, sample->trace.type);
-	printf("	flags is %i / %x \n", sample->trace.flags, sample->trace.flags);
-	printf("	p/c   is %i / %x \n", sample->trace.preempt_count, sample->trace.preempt_count);
-	printf("	pid   is %i / %x \n", sample->trace.pid, sample->trace.pid);
-	printf("	lock dept  is %i / %x \n", sample->trace.lock_depth, sample->trace.lock_depth);
-
-	x = (unsigned char *)sample;
-	for (i = 0; i < sample->header.size; i++)
-		printf("%02x ", *(x+i));
-	printf("\n");
-#endif
-	return sample->trace.time;
+struct perf_lost_record {
+	struct perf_event_header	header;
+	uint64_t			id;
+	uint64_t			lost;
+};
 
-}
+/*
+ * Read position in the records of one perf_event: first the spans the
+ * drain thread copied out during the interval, then what is still in the
+ * ring buffer. Each ring is filled by a single cpu and therefore already
+ * in time order, so the bundle only has to merge the heads of all rings
+ * instead of sorting every record.
+ */
+struct ring_cursor {
+	class perf_event *ev;
+	vector<struct perf_span> *spans;
+	unsigned int span;
+	unsigned long offset;
+	unsigned char *data;
+	unsigned long mask;
+	uint64_t pos;
+	uint64_t end;
+	unsigned int index;
+	uint64_t *lost;			/* of the cpu the ring belongs to */
+	struct perf_sample *sample;
+	uint64_t time;
+};
 
-static bool event_sort_function (void *i, void *j)
+/* heap order: earliest sample on top, ties broken by ring for stability */
+static bool cursor_later(const struct ring_cursor *a, const struct ring_cursor *b)
 {
-	struct perf_event_header *I, *J;
-
-	I = (struct perf_event_header *) i;
-	J = (struct perf_event_header *) j;
-	return (timestamp(I)<timestamp(J));
+	if (a->time != b->time)
+		return a->time > b->time;
+	return a->index > b->index;
 }
 
 /*
- * sample's PERF_SAMPLE_CPU cpu nr is a raw_smp_processor_id() by the
- * time of perf_event_output(), which may differ from struct perf_event
- * cpu, thus we need to fix sample->trace.cpu.
+ * Next record of the cursor, contiguous in memory. Records in the ring
+ * are used in place; only a record that wraps around the end of the ring
+ * is copied into the arena.
  */
-static void fixup_sample_trace_cpu(struct perf_sample *sample)
+static struct perf_event_header *next_record(struct ring_cursor *cursor, class perf_arena *arena)
 {
-	struct tep_event *event;
-	struct tep_record rec;
-	unsigned long long cpu_nr;
-	int type;
-	int ret;
-
-	rec.data = &sample->data;
-	type = tep_data_type(perf_event::tep, &rec);
-	event = tep_find_event(perf_event::tep, type);
-	if (!event)
-		return;
-	/** don't touch trace if event does not contain cpu_id field*/
-	ret = tep_get_field_val(NULL, event, "cpu_id", &rec, &cpu_nr, 0);
-	if (ret < 0)
-		return;
-	sample->trace.cpu = cpu_nr;
+	struct perf_event_header *header;
+	unsigned long offset, first;
+	unsigned char *record;
+
+	while (cursor->span < cursor->spans->size()) {
+		struct perf_span *span = &(*cursor->spans)[cursor->span];
+
+		if (cursor->offset + sizeof(*header) <= span->len) {
+			header = (struct perf_event_header *)(span->data + cursor->offset);
+			if (header->size && cursor->offset + header->size <= span->len) {
+				cursor->offset += header->size;
+				return header;
+			}
+		}
+		cursor->span++;
+		cursor->offset = 0;
+	}
+
+	if (cursor->pos >= cursor->end)
+		return NULL;
+
+	offset = cursor->pos & cursor->mask;
+	header = (struct perf_event_header *)(cursor->data + offset);
+	if (header->size == 0 || cursor->pos + header->size > cursor->end) {
+		cursor->pos = cursor->end;
+		return NULL;
+	}
+	cursor->pos += header->size;
+
+	if (offset + header->size <= cursor->mask + 1)
+		return header;
+
+	record = (unsigned char *)arena->alloc(header->size);
+	if (!record)
+		return NULL;
+	first = cursor->mask + 1 - offset;
+	memcpy(record, header, first);
+	memcpy(record + first, cursor->data, header->size - first);
+	return (struct perf_event_header *)record;
+}
+
+/* advance the cursor to its next PERF_RECORD_SAMPLE, counting lost ones */
+static bool next_sample(struct ring_cursor *cursor, class perf_arena *arena)
+{
+	struct perf_event_header *header;
+
+	while ((header = next_record(cursor, arena))) {
+		if (header->type == PERF_RECORD_LOST) {
+			struct perf_lost_record *rec = (struct perf_lost_record *)header;
+
+			/*
+			 * rec->id is whichever event of the shared ring got to
+			 * write next, not the one that was dropped; only the cpu
+			 * is known.
+			 */
+			*cursor->lost += rec->lost;
+			continue;
+		}
+		if (header->type != PERF_RECORD_SAMPLE)
+			continue;
+
+		cursor->sample = (struct perf_sample *)header;
+		cursor->time = cursor->sample->trace.time;
+		return true;
+	}
+	return false;
 }
 
 void perf_bundle::process(void)
 {
 	unsigned int i;
+	unsigned long count = 0;
 	class perf_event *ev;
+	vector<struct ring_cursor> cursors;
+	vector<struct ring_cursor *> heap;
+	bool capturing = capture_active();
+
+	/* the first consumer to ask processes the interval for all of them */
+	if (processed)
+		return;
+	processed = true;
+
+	for (i = 0; i < consumers.size(); i++)
+		if (consumers[i]->prepare)
+			consumers[i]->prepare();
 
-	/* fixme: reserve enough space in the array in one go */
+	if (replay_active()) {
+		replay();
+		return;
+	}
+
+	if (capture_active()) {
+		vector<struct tep_event *> formats;
+
+		for (i = 0; i < decoders.size(); i++)
+			if (decoders[i])
+				formats.push_back(tep_find_event(perf_event::tep, i));
+		capture_events(formats);
+	}
+
+	drained.resize(events.size());
+	if (lost.size() < ring_pages.size())
+		lost.resize(ring_pages.size(), 0);
+
+	cursors.reserve(events.size());
 	for (i = 0; i < events.size(); i++) {
+		struct ring_cursor cursor;
+
 		ev = events[i];
-		if (!ev)
+		if (!ev || !ev->ring_data())
 			continue;
-		ev->process(&records);
+
+		cursor.ev = ev;
+		cursor.spans = &drained[i];
+		cursor.span = 0;
+		cursor.offset = 0;
+		cursor.data = ev->ring_data();
+		cursor.mask = ev->ring_size() - 1;
+		cursor.pos = ev->ring_tail();
+		cursor.end = cursor.pos + ev->pending_bytes();
+		cursor.index = cursors.size();
+		cursor.lost = &lost[ev->get_cpu()];
+		cursor.sample = NULL;
+		cursor.time = 0;
+		cursors.push_back(cursor);
+
+		if ((unsigned int)ev->get_cpu() < ring_peak.size() &&
+		    cursor.end - cursor.pos > ring_peak[ev->get_cpu()])
+			ring_peak[ev->get_cpu()] = cursor.end - cursor.pos;
 	}
-	sort(records.begin(), records.end(), event_sort_function);
 
-	for (i = 0; i < records.size(); i++) {
+	heap.reserve(cursors.size());
+	for (i = 0; i < cursors.size(); i++)
+		if (next_sample(&cursors[i], &arena))
+			heap.push_back(&cursors[i]);
+	make_heap(heap.begin(), heap.end(), cursor_later);
+
+	while (!heap.empty()) {
+		struct ring_cursor *cursor;
 		struct perf_sample *sample;
 
-		sample = (struct perf_sample *)records[i];
-		if (!sample)
+		class trace_decoder *decoder;
+
+		pop_heap(heap.begin(), heap.end(), cursor_later);
+		cursor = heap.back();
+		sample = cursor->sample;
+
+		decoder = find_decoder(&sample->data);
+		fixup_sample_trace_cpu(sample, decoder);
+		if (capturing)
+			capture_record(sample, sample->header.size);
+		dispatch(decoder, &sample->data, sample->trace.cpu, sample->trace.time);
+		count++;
+
+		if (next_sample(cursor, &arena))
+			push_heap(heap.begin(), heap.end(), cursor_later);
+		else
+			heap.pop_back();
+	}
+
+	/* everything up to the head we started from has been handled */
+	for (i = 0; i < cursors.size(); i++)
+		cursors[i].ev->consume(cursors[i].end - cursors[i].ev->ring_tail());
+
+	if (capturing)
+		capture_interval_end(count);
+
+	if (debug_learning)
+		fprintf(stderr, "perf: %lu samples from %lu rings, %lu lost, %lu arena allocations "
+			"(%lu bytes), %lu bytes arena capacity, %lu chunk mallocs\n",
+			count, (unsigned long)cursors.size(), (unsigned long)lost_total(),
+			arena.allocations, arena.bytes, (unsigned long)arena.capacity(),
+			arena.chunk_allocs);
+	resize_rings();
+}
+
+/*
+ * Pick each cpu's ring size for the next interval from how full it got
+ * in this one: grow when it was more than half full or lost records,
+ * shrink when it never got past an eighth. Idle cpus end up with small
+ * rings, the ones taking the interrupt load with big ones.
+ */
+void perf_bundle::resize_rings(void)
+{
+	vector<uint64_t> cpu_lost(lost);
+	unsigned long size, mapped = 0;
+	unsigned int i, rings = 0;
+	int pages;
+
+	cpu_lost.resize(ring_pages.size(), 0);
+
+	for (i = 0; i < ring_pages.size(); i++) {
+		if (!ring_pages[i])
 			continue;
 
-		if (sample->header.type != PERF_RECORD_SAMPLE)
+		pages = ring_pages[i];
+		size = (unsigned long)pages * getpagesize();
+		if (cpu_lost[i] || ring_peak[i] > size / 2)
+			pages *= 2;
+		else if (ring_peak[i] < size / 8)
+			pages /= 2;
+		pages = clamp_ring_pages(pages);
+
+		if (debug_learning && pages != ring_pages[i])
+			fprintf(stderr, "perf: cpu %u ring %d -> %d pages (peak %lu of %lu bytes, %lu lost)\n",
+				i, ring_pages[i], pages, ring_peak[i], size,
+				(unsigned long)cpu_lost[i]);
+
+		/* what is mapped now, the new size applies from the next start() */
+		mapped += size + getpagesize();
+		rings++;
+
+		ring_pages[i] = pages;
+		ring_peak[i] = 0;
+	}
+
+	if (debug_learning)
+		fprintf(stderr, "perf: %lu kB mapped in %u rings\n", mapped / 1024, rings);
+}
+
+/*
+ * Dispatch the next interval of a capture file. The records were written
+ * by process() after the merge and the cpu fixup, so they are used as is.
+ */
+void perf_bundle::replay(void)
+{
+	struct perf_event_header *header;
+	struct perf_sample *sample;
+	unsigned char *data;
+	unsigned long len, pos;
+	unsigned long count = 0;
+
+	if (!replay_next_interval(&data, &len))
+		return;
+
+	for (pos = 0; pos + sizeof(*header) <= len; pos += header->size) {
+		header = (struct perf_event_header *)(data + pos);
+		if (header->size < sizeof(*header))
+			break;
+		if (header->type != PERF_RECORD_SAMPLE)
+			continue;
+
+		sample = (struct perf_sample *)header;
+		dispatch(find_decoder(&sample->data), &sample->data, sample->trace.cpu, sample->trace.time);
+		count++;
+	}
+
+	if (debug_learning)
+		fprintf(stderr, "perf: %lu samples replayed\n", count);
+}
+
+uint64_t perf_bundle::lost_total(void)
+{
+	unsigned int i;
+	uint64_t total = 0;
+
+	for (i = 0; i < lost.size(); i++)
+		total += lost[i];
+	return total;
+}
+
+void perf_bundle::lost_samples(vector<struct perf_lost> &list)
+{
+	unsigned int i;
+
+	for (i = 0; i < lost.size(); i++) {
+		struct perf_lost entry;
+
+		if (!lost[i])
 			continue;
 
-		fixup_sample_trace_cpu(sample);
-		handle_trace_point(&sample->data, sample->trace.cpu, sample->trace.time);
+		entry.cpu = i;
+		entry.lost = lost[i];
+		list.push_back(entry);
+	}
+}
+
+void perf_lost_samples(vector<struct perf_lost> &list)
+{
+	unsigned int i;
+
+	for (i = 0; i < all_bundles.size(); i++)
+		all_bundles[i]->lost_samples(list);
+}
+
+/* look the event up by the id in its common_type field */
+class trace_decoder *perf_bundle::find_decoder(void *trace)
+{
+	unsigned int id;
+
+	if (type_field.offset < 0)
+		return NULL;
+
+	if (type_field.size == 2) {
+		uint16_t type;
+
+		memcpy(&type, (unsigned char *)trace + type_field.offset, sizeof(type));
+		id = type;
+	} else {
+		uint32_t type;
+
+		memcpy(&type, (unsigned char *)trace + type_field.offset, sizeof(type));
+		id = type;
+	}
+
+	if (id >= decoders.size())
+		return NULL;
+	return decoders[id];
+}
+
+/*
+ * Run the handler every consumer registered for the event; events added
+ * without one still go through the virtual handle_trace_point().
+ */
+void perf_bundle::dispatch(class trace_decoder *decoder, void *trace, int cpu, uint64_t time)
+{
+	for (; decoder; decoder = decoder->next) {
+		if (decoder->handler)
+			decoder->handler(decoder, trace, cpu, time);
+		else
+			handle_trace_point(trace, cpu, time);
 	}
 }
 
@@ -285,13 +937,42 @@ void perf_bundle::handle_trace_point(void *trace, int cpu, uint64_t time)
 {
 	printf("UH OH... abstract handle_trace_point called\n");
 }
+
+static class perf_bundle *session;
+static int session_refs;
+
+class perf_bundle *trace_session_get(void)
+{
+	if (!session)
+		session = new perf_bundle();
+	session_refs++;
+	return session;
+}
+
+void trace_session_put(void)
+{
+	if (!session || --session_refs > 0)
+		return;
+	session->release();
+	delete session;
+	session = NULL;
+}
 #else /* _WIN32 */
 /* Stub implementations for perf_bundle on Windows */
+perf_bundle::perf_bundle(void) {}
+perf_bundle::~perf_bundle() {}
+uint64_t perf_bundle::lost_total(void) { return 0; }
+void perf_bundle::lost_samples(vector<struct perf_lost> &) {}
+void perf_lost_samples(vector<struct perf_lost> &) {}
 void perf_bundle::release(void) {}
 void perf_bundle::start(void) {}
 void perf_bundle::stop(void) {}
 void perf_bundle::clear(void) {}
 void perf_bundle::process(void) {}
-bool perf_bundle::add_event(const char *, const char *) { return false; }
+void perf_bundle::replay(void) {}
+bool perf_bundle::add_event(const char *, const char *, trace_handler, const char * const *) { return false; }
+void perf_bundle::add_consumer(const struct trace_consumer *) {}
 void perf_bundle::handle_trace_point(void *, int, uint64_t) {}
+class perf_bundle *trace_session_get(void) { return NULL; }
+void trace_session_put(void) {}
 #endif /* !_WIN32 */
@@ -28,31 +28,208 @@
 #include <iostream>
 #include <vector>
 #include <map>
+#include <stdint.h>
+#include <string.h>
 
 using namespace std;
 
 #include "perf.h"
+#include "../platform/platform.h"
 class perf_event;
 
+/*
+ * Bump allocator for trace records. Memory is handed out from large
+ * chunks that are kept around between measurement intervals, so that
+ * reset() is O(1) and a steady state interval does not hit malloc at all.
+ * Pointers stay valid until the next reset() or release().
+ */
+class perf_arena {
+	struct chunk {
+		unsigned char *data;
+		size_t size;
+	};
+	vector<struct chunk> chunks;
+	unsigned int current;
+	size_t used;
+	size_t chunk_size;
+public:
+	unsigned long allocations;	/* since last reset() */
+	unsigned long bytes;		/* since last reset() */
+	unsigned long chunk_allocs;	/* malloc() calls, ever */
+
+	perf_arena(size_t _chunk_size = 1024 * 1024);
+	~perf_arena(void);
+
+	void *alloc(size_t size);
+	void reset(void);
+	void release(void);
+	size_t capacity(void);
+};
+
+struct trace_field {
+	int offset;		/* -1 if the event does not have this field */
+	int size;
+	bool string;
+	bool dynamic;		/* __data_loc: offset/len stored in the record */
+};
+
+class trace_decoder;
+
+typedef void (*trace_handler)(class trace_decoder *decoder, void *trace, int cpu, uint64_t time);
+
+/*
+ * Everything needed to handle one tracepoint, resolved once when the
+ * event is added to a bundle: the handler and where the fields it wants
+ * live in the raw record. Fields are addressed by their index in the
+ * list passed to perf_bundle::add_event(). When several consumers add
+ * the same event, each gets its own decoder on the next chain.
+ */
+class trace_decoder {
+public:
+	int id;
+	const char *name;
+	trace_handler handler;
+	vector<struct trace_field> fields;
+	struct trace_field cpu_field;	/* "cpu_id", for fixup_sample_trace_cpu() */
+	class trace_decoder *next;
+
+	bool has(unsigned int field)
+	{
+		return field < fields.size() && fields[field].offset >= 0;
+	}
+
+	uint64_t value(void *trace, unsigned int field)
+	{
+		return load(trace, fields[field]);
+	}
+
+	static uint64_t load(void *trace, const struct trace_field &field)
+	{
+		const unsigned char *ptr = (const unsigned char *)trace + field.offset;
+		uint8_t v8;
+		uint16_t v16;
+		uint32_t v32;
+		uint64_t v64;
+
+		switch (field.size) {
+		case 1:
+			v8 = *ptr;
+			return v8;
+		case 2:
+			memcpy(&v16, ptr, sizeof(v16));
+			return v16;
+		case 4:
+			memcpy(&v32, ptr, sizeof(v32));
+			return v32;
+		case 8:
+			memcpy(&v64, ptr, sizeof(v64));
+			return v64;
+		}
+		return 0;
+	}
+
+	const char *str(void *trace, unsigned int field)
+	{
+		if (!fields[field].string)
+			return NULL;
+		if (fields[field].dynamic)
+			return (const char *)trace + (value(trace, field) & 0xffff);
+		return (const char *)trace + fields[field].offset;
+	}
+};
+
+/* a piece of a ring buffer copied out by the drain thread */
+struct perf_span {
+	unsigned char *data;
+	unsigned long len;
+};
+
+/*
+ * Records the kernel had to drop on one cpu. All events of a cpu share
+ * its ring, and the kernel does not say which of them lost records.
+ */
+struct perf_lost {
+	int cpu;
+	uint64_t lost;
+};
+
+/*
+ * A user of a shared bundle. prepare() runs right before the events of
+ * an interval are dispatched, no matter which consumer calls process().
+ */
+struct trace_consumer {
+	const char *name;
+	void (*prepare)(void);
+};
+
+extern int perf_background_drain;
+extern int perf_ring_min_pages;
+extern int perf_ring_max_pages;
 
 class  perf_bundle {
 protected:
 	vector<class perf_event *> events;
+	class perf_arena arena;
+
+	/* per entry in events[] */
+	vector< vector<struct perf_span> > drained;
+
+	vector<uint64_t> lost;			/* per cpu */
+
+	/* per cpu: ring size for the next start(), fill level seen this interval */
+	vector<int> ring_pages;
+	vector<unsigned long> ring_peak;
+	void resize_rings(void);
+
+	vector<const struct trace_consumer *> consumers;
+	bool running;
+	bool processed;
+
+	bool drain_stop;		/* only touched with __atomic builtins */
+	bool drain_running;
+	pt_thread_t drain_tid;
+
+	void drain_event(unsigned int i);
+
+	vector<class trace_decoder *> decoders;	/* indexed by event id */
+	struct trace_field type_field;
+
+	class trace_decoder *create_decoder(unsigned int id, trace_handler handler,
+					    const char * const *fields);
+	class trace_decoder *find_decoder(void *trace);
+	void dispatch(class trace_decoder *decoder, void *trace, int cpu, uint64_t time);
+	void replay(void);
 public:
-	vector<void *> records;
-	virtual ~perf_bundle() {};
+	perf_bundle(void);
+	virtual ~perf_bundle();
 
 	virtual void release(void);
-	bool add_event(const char *system_name, const char *event_name);
+	bool add_event(const char *system_name, const char *event_name,
+		       trace_handler handler = NULL, const char * const *fields = NULL);
+	void add_consumer(const struct trace_consumer *consumer);
 
 	void start(void);
 	void stop(void);
 	void clear(void);
 
 	void process(void);
+	void drain_loop(void);
+
+	uint64_t lost_total(void);
+	void lost_samples(vector<struct perf_lost> &list);
 
 	virtual void handle_trace_point(void *trace, int cpu = 0, uint64_t time = 0);
 };
 
+extern void perf_lost_samples(vector<struct perf_lost> &list);
+
+/*
+ * The one bundle all accounting code subscribes its tracepoints on, so
+ * that an event wanted by several consumers is only traced and merged
+ * once. Reference counted; the last put releases it.
+ */
+extern class perf_bundle *trace_session_get(void);
+extern void trace_session_put(void);
+
 
 #endif
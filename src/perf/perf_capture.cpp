@@ -0,0 +1,482 @@
+/*
+ * Copyright 2010, Intel Corporation
+ *
+ * This file is part of PowerTOP
+ *
+ * This program file is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; version 2 of the License.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program in a file named COPYING; if not, write to the
+ * Free Software Foundation, Inc,
+ * 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1301 USA
+ * or just google for it.
+ *
+ * Authors:
+ *	Arjan van de Ven <arjan@linux.intel.com>
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include <unordered_map>
+#include <unordered_set>
+
+#include "perf_capture.h"
+#include "perf.h"
+#include "../lib.h"
+
+#ifndef _WIN32
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "perf_event.h"
+#include "../cpu/cpu.h"
+
+static FILE *capture_file;
+static bool capture_header_written;
+static uint64_t capture_intervals;
+static unordered_set<uint64_t> captured_symbols;
+
+static unsigned char *replay_map;
+static size_t replay_size;
+static uint64_t replay_pos;
+static uint64_t replay_intervals;
+static vector<struct capture_cpu> replay_cpus;
+
+/* every record of a pid, in file order */
+static unordered_map<int, vector<struct capture_pid *> > replay_pids;
+static unordered_map<uint64_t, const char *> replay_symbols;
+
+/* a cmdline or cgroup path longer than this is cut short in the capture */
+#define CAPTURE_STRING_MAX	4095
+
+static inline uint64_t capture_align(uint64_t len)
+{
+	return (len + 7) & ~(uint64_t)7;
+}
+
+/* write str including its NUL, zero padded to the next 8 bytes */
+static void capture_write_string(const char *str, uint32_t len)
+{
+	static const char zero[8] = { 0 };
+	size_t size = strlen(str) + 1;
+
+	fwrite(str, 1, size, capture_file);
+	fwrite(zero, 1, len - size, capture_file);
+}
+
+/* the same for the first len - 1 characters at most of str */
+static void capture_write_chars(const char *str, size_t chars, uint32_t len)
+{
+	static const char zero[8] = { 0 };
+
+	fwrite(str, 1, chars, capture_file);
+	fwrite(zero, 1, len - chars, capture_file);
+}
+
+bool capture_open(const char *filename)
+{
+	capture_file = fopen(filename, "wb");
+	if (!capture_file) {
+		fprintf(stderr, _("Cannot open capture file %s (%s)\n"), filename, strerror(errno));
+		return false;
+	}
+	/* samples come in bursts once per interval, write them in big pieces */
+	setvbuf(capture_file, NULL, _IOFBF, 1024 * 1024);
+	capture_header_written = false;
+	return true;
+}
+
+void capture_close(void)
+{
+	if (!capture_file)
+		return;
+	fclose(capture_file);
+	capture_file = NULL;
+}
+
+bool capture_active(void)
+{
+	return capture_file != NULL;
+}
+
+/*
+ * Write the file header: the cpu topology and the format of every event
+ * that can show up in the records, so that a replay can decode them on a
+ * machine with different event ids. Only the first call does anything.
+ */
+void capture_events(vector<struct tep_event *> &events)
+{
+	struct capture_header header;
+	unsigned int i;
+	long end;
+
+	if (!capture_file || capture_header_written)
+		return;
+	capture_header_written = true;
+
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, CAPTURE_MAGIC, sizeof(CAPTURE_MAGIC));
+	header.version = CAPTURE_VERSION;
+	header.page_size = getpagesize();
+	fwrite(&header, sizeof(header), 1, capture_file);
+
+	for (i = 0; i < all_cpus.size(); i++) {
+		struct capture_cpu cpu;
+		class abstract_cpu *core;
+
+		if (!all_cpus[i])
+			continue;
+
+		memset(&cpu, 0, sizeof(cpu));
+		cpu.number = i;
+		core = all_cpus[i]->parent;
+		if (core) {
+			cpu.core = core->get_number();
+			if (core->parent)
+				cpu.package = core->parent->get_number();
+		}
+		fwrite(&cpu, sizeof(cpu), 1, capture_file);
+		header.nr_cpus++;
+	}
+
+	for (i = 0; i < events.size(); i++) {
+		struct capture_format format;
+		char *buf;
+		int size;
+
+		buf = tracefs_event_file_read(NULL, events[i]->system, events[i]->name, "format", &size);
+		if (!buf)
+			continue;
+
+		format.system_len = capture_align(strlen(events[i]->system) + 1);
+		format.format_len = capture_align(strlen(buf) + 1);
+		fwrite(&format, sizeof(format), 1, capture_file);
+		capture_write_string(events[i]->system, format.system_len);
+		capture_write_string(buf, format.format_len);
+		free(buf);
+		header.nr_formats++;
+	}
+
+	/* now that the counts are known, fill them in */
+	end = ftell(capture_file);
+	header.data_offset = end;
+	fseek(capture_file, 0, SEEK_SET);
+	fwrite(&header, sizeof(header), 1, capture_file);
+	fseek(capture_file, end, SEEK_SET);
+}
+
+void capture_record(void *record, unsigned int size)
+{
+	if (!capture_file)
+		return;
+	fwrite(record, 1, size, capture_file);
+}
+
+void capture_interval_end(uint64_t samples)
+{
+	struct capture_interval interval;
+
+	if (!capture_file)
+		return;
+
+	memset(&interval, 0, sizeof(interval));
+	interval.type = CAPTURE_RECORD_INTERVAL;
+	interval.size = sizeof(interval);
+	interval.samples = samples;
+	fwrite(&interval, sizeof(interval), 1, capture_file);
+	fflush(capture_file);
+	capture_intervals++;
+}
+
+/*
+ * What the pid cache read for pid, for the interval that was closed last:
+ * that is the one whose processes are being merged when this is called.
+ */
+void capture_pid_info(int pid, int tgid, bool has_cmdline, const string &cmdline, const string &cgroup)
+{
+	struct capture_pid record;
+	size_t cmdline_chars, cgroup_chars;
+	uint32_t cgroup_len;
+
+	if (!capture_file || !capture_header_written)
+		return;
+
+	cmdline_chars = min(cmdline.size(), (size_t)CAPTURE_STRING_MAX);
+	cgroup_chars = min(cgroup.size(), (size_t)CAPTURE_STRING_MAX);
+
+	memset(&record, 0, sizeof(record));
+	record.type = CAPTURE_RECORD_PID;
+	record.interval = capture_intervals ? capture_intervals - 1 : 0;
+	record.pid = pid;
+	record.tgid = tgid;
+	record.has_cmdline = has_cmdline;
+	record.cmdline_len = capture_align(cmdline_chars + 1);
+	cgroup_len = capture_align(cgroup_chars + 1);
+	record.size = sizeof(record) + record.cmdline_len + cgroup_len;
+
+	fwrite(&record, sizeof(record), 1, capture_file);
+	capture_write_chars(cmdline.c_str(), cmdline_chars, record.cmdline_len);
+	capture_write_chars(cgroup.c_str(), cgroup_chars, cgroup_len);
+}
+
+/* each address only once, symbols do not change while we run */
+void capture_kernel_symbol(uint64_t address, const char *name)
+{
+	struct capture_symbol record;
+	size_t chars;
+	uint32_t len;
+
+	if (!capture_file || !capture_header_written)
+		return;
+	if (!captured_symbols.insert(address).second)
+		return;
+
+	chars = min(strlen(name), (size_t)CAPTURE_STRING_MAX);
+	len = capture_align(chars + 1);
+
+	memset(&record, 0, sizeof(record));
+	record.type = CAPTURE_RECORD_SYMBOL;
+	record.address = address;
+	record.size = sizeof(record) + len;
+
+	fwrite(&record, sizeof(record), 1, capture_file);
+	capture_write_chars(name, chars, len);
+}
+
+static bool replay_fail(const char *filename, const char *why)
+{
+	fprintf(stderr, _("Cannot replay %s: %s\n"), filename, why);
+	replay_close();
+	return false;
+}
+
+/*
+ * One pass over the records for the pid and symbol records, so that the
+ * lookups do not depend on how far the replay has got in the file.
+ */
+static void replay_index_metadata(void)
+{
+	struct perf_event_header *header;
+	uint64_t pos;
+
+	for (pos = replay_pos; pos + sizeof(*header) <= replay_size; pos += header->size) {
+		header = (struct perf_event_header *)(replay_map + pos);
+		if (header->size < sizeof(*header) || pos + header->size > replay_size)
+			break;
+
+		if (header->type == CAPTURE_RECORD_PID && header->size >= sizeof(struct capture_pid)) {
+			struct capture_pid *record = (struct capture_pid *)header;
+
+			if (sizeof(*record) + record->cmdline_len < header->size)
+				replay_pids[record->pid].push_back(record);
+		} else if (header->type == CAPTURE_RECORD_SYMBOL && header->size > sizeof(struct capture_symbol)) {
+			struct capture_symbol *record = (struct capture_symbol *)header;
+
+			replay_symbols[record->address] = (const char *)(record + 1);
+		}
+	}
+}
+
+/*
+ * Map a capture file and load its event formats into the tep handle, so
+ * that perf_bundle::add_event() resolves event names to the ids of the
+ * machine the capture was taken on.
+ */
+bool replay_open(const char *filename)
+{
+	struct capture_header *header;
+	struct stat st;
+	uint64_t pos;
+	unsigned int i;
+	int fd;
+
+	fd = open(filename, O_RDONLY);
+	if (fd < 0)
+		return replay_fail(filename, strerror(errno));
+	if (fstat(fd, &st) < 0 || (size_t)st.st_size < sizeof(*header)) {
+		close(fd);
+		return replay_fail(filename, _("file too short"));
+	}
+
+	replay_size = st.st_size;
+	replay_map = (unsigned char *)mmap(NULL, replay_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (replay_map == MAP_FAILED) {
+		replay_map = NULL;
+		return replay_fail(filename, strerror(errno));
+	}
+
+	header = (struct capture_header *)replay_map;
+	if (memcmp(header->magic, CAPTURE_MAGIC, sizeof(CAPTURE_MAGIC)) != 0)
+		return replay_fail(filename, _("not a PowerTOP capture"));
+	if (header->version != CAPTURE_VERSION)
+		return replay_fail(filename, _("unsupported capture version"));
+	if (header->data_offset > replay_size)
+		return replay_fail(filename, _("file truncated"));
+
+	pos = sizeof(*header);
+	for (i = 0; i < header->nr_cpus; i++) {
+		if (pos + sizeof(struct capture_cpu) > header->data_offset)
+			return replay_fail(filename, _("file truncated"));
+		replay_cpus.push_back(*(struct capture_cpu *)(replay_map + pos));
+		pos += sizeof(struct capture_cpu);
+	}
+
+	perf_event::tep_get();
+	for (i = 0; i < header->nr_formats; i++) {
+		struct capture_format *format;
+		const char *system, *text;
+
+		format = (struct capture_format *)(replay_map + pos);
+		if (pos + sizeof(*format) > header->data_offset ||
+		    pos + sizeof(*format) + format->system_len + format->format_len > header->data_offset)
+			return replay_fail(filename, _("file truncated"));
+
+		system = (const char *)(format + 1);
+		text = system + format->system_len;
+		tep_parse_event(perf_event::tep, text, strnlen(text, format->format_len), system);
+		pos += sizeof(*format) + format->system_len + format->format_len;
+	}
+
+	replay_pos = header->data_offset;
+	replay_intervals = 0;
+	replay_index_metadata();
+	return true;
+}
+
+void replay_close(void)
+{
+	if (!replay_map)
+		return;
+	munmap(replay_map, replay_size);
+	replay_map = NULL;
+	replay_size = 0;
+	replay_pos = 0;
+	replay_intervals = 0;
+	replay_cpus.clear();
+	replay_pids.clear();
+	replay_symbols.clear();
+	perf_event::tep_put();
+}
+
+bool replay_active(void)
+{
+	return replay_map != NULL;
+}
+
+bool replay_pending(void)
+{
+	return replay_map && replay_pos < replay_size;
+}
+
+/*
+ * The records of the next interval, in place in the mapping. A capture
+ * that was cut short (powertop killed mid interval) still replays up to
+ * the last complete record.
+ */
+bool replay_next_interval(unsigned char **data, unsigned long *len)
+{
+	struct perf_event_header *header;
+	uint64_t pos;
+
+	if (!replay_pending())
+		return false;
+
+	*data = replay_map + replay_pos;
+	for (pos = replay_pos; pos + sizeof(*header) <= replay_size; pos += header->size) {
+		header = (struct perf_event_header *)(replay_map + pos);
+		if (header->size < sizeof(*header) || pos + header->size > replay_size)
+			break;
+		if (header->type == CAPTURE_RECORD_INTERVAL) {
+			*len = pos - replay_pos;
+			replay_pos = pos + header->size;
+			replay_intervals++;
+			return true;
+		}
+	}
+
+	*len = pos - replay_pos;
+	replay_pos = replay_size;
+	replay_intervals++;
+	return true;
+}
+
+void replay_topology(vector<struct capture_cpu> &cpus)
+{
+	cpus = replay_cpus;
+}
+
+/*
+ * What the capturing machine knew about pid in the interval being
+ * replayed: its last record up to that interval, so that a pid that got
+ * reused during the capture is described by the task of the time.
+ */
+bool replay_pid_info(int pid, int *tgid, bool *has_cmdline, string &cmdline, string &cgroup)
+{
+	unordered_map<int, vector<struct capture_pid *> >::iterator it;
+	struct capture_pid *record = NULL;
+	uint64_t current = replay_intervals ? replay_intervals - 1 : 0;
+	const char *strings;
+	unsigned int i;
+
+	it = replay_pids.find(pid);
+	if (it == replay_pids.end())
+		return false;
+
+	for (i = 0; i < it->second.size(); i++) {
+		if (it->second[i]->interval > current)
+			break;
+		record = it->second[i];
+	}
+	if (!record)
+		record = it->second[0];
+
+	strings = (const char *)(record + 1);
+	*tgid = record->tgid;
+	*has_cmdline = record->has_cmdline;
+	cmdline = string(strings, strnlen(strings, record->cmdline_len));
+	strings += record->cmdline_len;
+	cgroup = string(strings, strnlen(strings, record->size - sizeof(*record) - record->cmdline_len));
+	return true;
+}
+
+/* "" for addresses the capture never had to look up */
+const char *replay_kernel_symbol(uint64_t address)
+{
+	unordered_map<uint64_t, const char *>::iterator it;
+
+	it = replay_symbols.find(address);
+	if (it == replay_symbols.end())
+		return "";
+	return it->second;
+}
+#else /* _WIN32 */
+bool capture_open(const char *) { return false; }
+void capture_close(void) {}
+bool capture_active(void) { return false; }
+void capture_events(vector<struct tep_event *> &) {}
+void capture_record(void *, unsigned int) {}
+void capture_interval_end(uint64_t) {}
+bool replay_open(const char *) { return false; }
+void replay_close(void) {}
+bool replay_active(void) { return false; }
+bool replay_pending(void) { return false; }
+bool replay_next_interval(unsigned char **, unsigned long *) { return false; }
+void replay_topology(vector<struct capture_cpu> &) {}
+void capture_pid_info(int, int, bool, const string &, const string &) {}
+void capture_kernel_symbol(uint64_t, const char *) {}
+bool replay_pid_info(int, int *, bool *, string &, string &) { return false; }
+const char *replay_kernel_symbol(uint64_t) { return ""; }
+#endif /* !_WIN32 */
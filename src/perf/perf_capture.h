@@ -0,0 +1,131 @@
+/*
+ * Copyright 2010, Intel Corporation
+ *
+ * This file is part of PowerTOP
+ *
+ * This program file is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; version 2 of the License.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program in a file named COPYING; if not, write to the
+ * Free Software Foundation, Inc,
+ * 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1301 USA
+ * or just google for it.
+ *
+ * Authors:
+ *	Arjan van de Ven <arjan@linux.intel.com>
+ */
+#ifndef _INCLUDE_GUARD_PERF_CAPTURE_H_
+#define _INCLUDE_GUARD_PERF_CAPTURE_H_
+
+#include <vector>
+#include <string>
+#include <stdint.h>
+
+using namespace std;
+
+/*
+ * Capture file layout, native byte order, everything 8 byte aligned so
+ * that the file can be mmap()ed and the records used in place:
+ *
+ *	struct capture_header
+ *	struct capture_cpu		x nr_cpus
+ *	struct capture_format		x nr_formats, each followed by the
+ *					  system name and the tracefs format
+ *					  text, both NUL terminated, padded
+ *	records				from data_offset to the end of the file
+ *
+ * The records are the PERF_RECORD_SAMPLEs as perf_bundle::process()
+ * dispatched them, already merged in time order and with the cpu fixed
+ * up, each interval closed by a CAPTURE_RECORD_INTERVAL. In between go
+ * the things the accounting code looked up on the machine itself, so that
+ * a replay elsewhere does not have to ask its own /proc: a
+ * CAPTURE_RECORD_PID for every pid whose status, cmdline and cgroup were
+ * read, and a CAPTURE_RECORD_SYMBOL for every kernel address that was
+ * turned into a function name.
+ */
+#define CAPTURE_MAGIC		"PTTRACE"
+#define CAPTURE_VERSION		2
+
+/* outside the range the kernel uses for perf_event_header.type */
+#define CAPTURE_RECORD_INTERVAL	0x7001
+#define CAPTURE_RECORD_PID	0x7002
+#define CAPTURE_RECORD_SYMBOL	0x7003
+
+struct capture_header {
+	char		magic[8];
+	uint32_t	version;
+	uint32_t	nr_cpus;
+	uint32_t	nr_formats;
+	uint32_t	page_size;
+	uint64_t	data_offset;
+};
+
+struct capture_cpu {
+	int32_t		number;
+	int32_t		package;
+	int32_t		core;
+	int32_t		reserved;
+};
+
+struct capture_format {
+	uint32_t	system_len;	/* including the NUL and padding */
+	uint32_t	format_len;	/* including the NUL and padding */
+};
+
+/* laid out like a struct perf_event_header plus payload */
+struct capture_interval {
+	uint32_t	type;
+	uint16_t	misc;
+	uint16_t	size;
+	uint64_t	samples;
+};
+
+/* followed by the cmdline and the cgroup path, NUL terminated and padded */
+struct capture_pid {
+	uint32_t	type;
+	uint16_t	misc;
+	uint16_t	size;
+	uint64_t	interval;	/* the one whose processes it describes */
+	int32_t		pid;
+	int32_t		tgid;
+	uint32_t	has_cmdline;
+	uint32_t	cmdline_len;	/* including the NUL and padding */
+};
+
+/* followed by the name, NUL terminated and padded */
+struct capture_symbol {
+	uint32_t	type;
+	uint16_t	misc;
+	uint16_t	size;
+	uint64_t	address;
+};
+
+struct tep_event;
+
+extern bool capture_open(const char *filename);
+extern void capture_close(void);
+extern bool capture_active(void);
+extern void capture_events(vector<struct tep_event *> &events);
+extern void capture_record(void *record, unsigned int size);
+extern void capture_interval_end(uint64_t samples);
+extern void capture_pid_info(int pid, int tgid, bool has_cmdline, const string &cmdline, const string &cgroup);
+extern void capture_kernel_symbol(uint64_t address, const char *name);
+
+extern bool replay_open(const char *filename);
+extern void replay_close(void);
+extern bool replay_active(void);
+extern bool replay_pending(void);
+extern bool replay_next_interval(unsigned char **data, unsigned long *len);
+extern void replay_topology(vector<struct capture_cpu> &cpus);
+extern bool replay_pid_info(int pid, int *tgid, bool *has_cmdline, string &cmdline, string &cgroup);
+extern const char *replay_kernel_symbol(uint64_t address);
+
+#endif
@@ -77,6 +77,16 @@ static inline int pt_thread_create(pt_thread_t *t, void *(*fn)(void *), void *ar
 static inline int pt_thread_join(pt_thread_t t) {
     return pthread_join(t, NULL);
 }
+typedef pthread_mutex_t pt_mutex_t;
+typedef pthread_cond_t pt_cond_t;
+static inline void pt_mutex_init(pt_mutex_t *m) { pthread_mutex_init(m, NULL); }
+static inline void pt_mutex_destroy(pt_mutex_t *m) { pthread_mutex_destroy(m); }
+static inline void pt_mutex_lock(pt_mutex_t *m) { pthread_mutex_lock(m); }
+static inline void pt_mutex_unlock(pt_mutex_t *m) { pthread_mutex_unlock(m); }
+static inline void pt_cond_init(pt_cond_t *c) { pthread_cond_init(c, NULL); }
+static inline void pt_cond_destroy(pt_cond_t *c) { pthread_cond_destroy(c); }
+static inline void pt_cond_wait(pt_cond_t *c, pt_mutex_t *m) { pthread_cond_wait(c, m); }
+static inline void pt_cond_broadcast(pt_cond_t *c) { pthread_cond_broadcast(c); }
 #else
 #  include <process.h>
 typedef HANDLE pt_thread_t;
@@ -89,6 +99,16 @@ static inline int pt_thread_join(pt_thread_t t) {
     CloseHandle(t);
     return 0;
 }
+typedef CRITICAL_SECTION pt_mutex_t;
+typedef CONDITION_VARIABLE pt_cond_t;
+static inline void pt_mutex_init(pt_mutex_t *m) { InitializeCriticalSection(m); }
+static inline void pt_mutex_destroy(pt_mutex_t *m) { DeleteCriticalSection(m); }
+static inline void pt_mutex_lock(pt_mutex_t *m) { EnterCriticalSection(m); }
+static inline void pt_mutex_unlock(pt_mutex_t *m) { LeaveCriticalSection(m); }
+static inline void pt_cond_init(pt_cond_t *c) { InitializeConditionVariable(c); }
+static inline void pt_cond_destroy(pt_cond_t *c) { (void)c; }
+static inline void pt_cond_wait(pt_cond_t *c, pt_mutex_t *m) { SleepConditionVariableCS(c, m, INFINITE); }
+static inline void pt_cond_broadcast(pt_cond_t *c) { WakeAllConditionVariable(c); }
 #endif /* _WIN32 */
 
 /* ------------------------------------------------------------------ */
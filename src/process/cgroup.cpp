@@ -0,0 +1,391 @@
+/*
+ * Copyright 2010, Intel Corporation
+ *
+ * This file is part of PowerTOP
+ *
+ * This program file is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; version 2 of the License.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program in a file named COPYING; if not, write to the
+ * Free Software Foundation, Inc,
+ * 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1301 USA
+ * or just google for it.
+ *
+ * Authors:
+ *	Arjan van de Ven <arjan@linux.intel.com>
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <iostream>
+#include <fstream>
+#include <vector>
+#include <algorithm>
+#include <unordered_map>
+
+#include "cgroup.h"
+#include "process.h"
+#include "../lib.h"
+#include "../display.h"
+#include "../report/report.h"
+#include "../report/report-maker.h"
+#include "../report/report-data-html.h"
+#include "../parameters/parameters.h"
+#include "../perf/perf_capture.h"
+
+/*
+ * Every cgroup seen, with its cpu.stat usage at both ends of the
+ * measurement. Ids index this table; cgroups that had no processes in an
+ * interval are dropped when the next one starts.
+ */
+struct cgroup_entry {
+	string		path;
+	bool		seen;
+	bool		have_start;
+	bool		have_end;
+	uint64_t	usage_start;	/* usage_usec from cpu.stat */
+	uint64_t	usage_end;
+};
+
+static vector<struct cgroup_entry> cgroups;
+static unordered_map<string, int> cgroup_index;
+
+static vector<class cgroup_consumer *> all_cgroups;
+static consumer_pool<class cgroup_consumer> cgroup_pool("cgroup");
+
+cgroup_consumer::cgroup_consumer(int _id) : power_consumer()
+{
+	id = _id;
+	processes = 0;
+}
+
+const char * cgroup_consumer::description(void)
+{
+	if (child_runtime > accumulated_runtime)
+		child_runtime = 0;
+
+	return cgroups[id].path.c_str();
+}
+
+double cgroup_consumer::cpu_stat_usage(void)
+{
+	struct cgroup_entry *entry = &cgroups[id];
+
+	if (!entry->have_start || !entry->have_end || entry->usage_end < entry->usage_start)
+		return -1;
+	return (entry->usage_end - entry->usage_start) / 1000.0 / measurement_time;
+}
+
+int cgroup_id(const string &path)
+{
+	unordered_map<string, int>::iterator it;
+	struct cgroup_entry entry;
+
+	if (path.empty())
+		return -1;
+
+	it = cgroup_index.find(path);
+	if (it != cgroup_index.end()) {
+		cgroups[it->second].seen = true;
+		return it->second;
+	}
+
+	entry.path = path;
+	entry.seen = true;
+	entry.have_start = false;
+	entry.have_end = false;
+	entry.usage_start = 0;
+	entry.usage_end = 0;
+	cgroups.push_back(entry);
+	cgroup_index[path] = cgroups.size() - 1;
+	return cgroups.size() - 1;
+}
+
+static bool read_cpu_stat(const string &path, uint64_t *usage)
+{
+	ifstream file;
+	char line[4096];
+
+	/* the machine of a capture is not the one we run on */
+	if (replay_active())
+		return false;
+
+	file.open(("/sys/fs/cgroup" + path + "/cpu.stat").c_str());
+	while (file) {
+		file.getline(line, sizeof(line));
+		if (strncmp(line, "usage_usec ", 11) == 0) {
+			*usage = strtoull(line + 11, NULL, 10);
+			return true;
+		}
+	}
+	return false;
+}
+
+/*
+ * Only cgroups that had processes last time are read here; one that
+ * shows up for the first time gets no cpu.stat figure this interval.
+ */
+void start_cgroup_measurement(void)
+{
+	unsigned int i, kept = 0;
+
+	cgroup_index.clear();
+	for (i = 0; i < cgroups.size(); i++) {
+		if (!cgroups[i].seen)
+			continue;
+		if (kept != i)
+			cgroups[kept] = cgroups[i];
+		cgroups[kept].seen = false;
+		cgroups[kept].have_end = false;
+		cgroups[kept].have_start = read_cpu_stat(cgroups[kept].path, &cgroups[kept].usage_start);
+		cgroup_index[cgroups[kept].path] = kept;
+		kept++;
+	}
+	cgroups.resize(kept);
+}
+
+void end_cgroup_measurement(void)
+{
+	unsigned int i;
+
+	for (i = 0; i < cgroups.size(); i++)
+		if (cgroups[i].have_start)
+			cgroups[i].have_end = read_cpu_stat(cgroups[i].path, &cgroups[i].usage_end);
+}
+
+/* called before merge_processes() folds processes of different cgroups together */
+void account_cgroups(void)
+{
+	unsigned int i;
+
+	clear_cgroups();
+	all_cgroups.resize(cgroups.size(), NULL);
+
+	for (i = 0; i < all_processes.size(); i++) {
+		class process *proc = all_processes[i];
+		class cgroup_consumer *group;
+
+		if (proc->cgroup < 0)
+			continue;
+
+		group = all_cgroups[proc->cgroup];
+		if (!group) {
+			group = new (cgroup_pool.get()) class cgroup_consumer(proc->cgroup);
+			all_cgroups[proc->cgroup] = group;
+		}
+
+		group->accumulated_runtime += proc->accumulated_runtime;
+		group->child_runtime += proc->child_runtime;
+		group->wake_ups += proc->wake_ups;
+		group->disk_hits += proc->disk_hits;
+		group->hard_disk_hits += proc->hard_disk_hits;
+		group->xwakes += proc->xwakes;
+		group->gpu_ops += proc->gpu_ops;
+		group->power_charge += proc->power_charge;
+		group->processes++;
+	}
+
+	/* only the cgroups that had processes */
+	all_cgroups.erase(remove(all_cgroups.begin(), all_cgroups.end(), (class cgroup_consumer *)NULL),
+			  all_cgroups.end());
+}
+
+void clear_cgroups(void)
+{
+	unsigned int i;
+
+	for (i = 0; i < all_cgroups.size(); i++)
+		if (all_cgroups[i])
+			cgroup_pool.put(all_cgroups[i]);
+	all_cgroups.clear();
+}
+
+static bool cgroup_sort(class cgroup_consumer *i, class cgroup_consumer *j)
+{
+	double iW, jW;
+
+	iW = i->Witts();
+	jW = j->Witts();
+
+	if (equals(iW, jW)) {
+		double iR, jR;
+
+		iR = i->accumulated_runtime - i->child_runtime;
+		jR = j->accumulated_runtime - j->child_runtime;
+
+		if (equals(iR, jR))
+			return i->wake_ups > j->wake_ups;
+		return (iR > jR);
+	}
+
+	return (iW > jW);
+}
+
+static void format_usage(class cgroup_consumer *group, char *usage, size_t len)
+{
+	usage[0] = 0;
+	if (group->usage() < 1000)
+		snprintf(usage, len, "%5.1f%s", group->usage(), group->usage_units());
+	else
+		snprintf(usage, len, "%5i%s", (int)group->usage(), group->usage_units());
+}
+
+/* the same units as power_consumer::usage(), empty if there is no figure */
+static void format_cpu_stat(class cgroup_consumer *group, char *buf, size_t len)
+{
+	double t = group->cpu_stat_usage();
+
+	buf[0] = 0;
+	if (t < 0)
+		return;
+	if (t < 0.7)
+		snprintf(buf, len, "%5.1f%s", t * 1000, utf_ok ? " µs/s" : " us/s");
+	else if (t < 1000)
+		snprintf(buf, len, "%5.1f ms/s", t);
+	else
+		snprintf(buf, len, "%5i ms/s", (int)t);
+}
+
+void cgroup_update_display(void)
+{
+	unsigned int i;
+	WINDOW *win;
+	int show_power;
+
+	win = get_ncurses_win("Cgroups");
+	if (!win)
+		return;
+
+	wclear(win);
+	wmove(win, 2, 0);
+
+	sort(all_cgroups.begin(), all_cgroups.end(), cgroup_sort);
+	show_power = global_power_valid();
+
+	if (show_power)
+		wprintw(win, "%s              %s      %s    %s  %s  %s\n", _("Power est."), _("Usage"), _("cpu.stat"),
+			_("Wakeups/s"), _("Disk IO/s"), _("Cgroup"));
+	else
+		wprintw(win, "                %s      %s    %s  %s  %s\n", _("Usage"), _("cpu.stat"),
+			_("Wakeups/s"), _("Disk IO/s"), _("Cgroup"));
+
+	for (i = 0; i < all_cgroups.size(); i++) {
+		char power[16];
+		char usage[20];
+		char cpu_stat[20];
+		char wakes[20];
+		char disks[20];
+		char descr[128];
+
+		format_watts(all_cgroups[i]->Witts(), power, 10);
+		if (!show_power)
+			strcpy(power, "          ");
+
+		format_usage(all_cgroups[i], usage, sizeof(usage));
+		align_string(usage, 14, 20);
+		format_cpu_stat(all_cgroups[i], cpu_stat, sizeof(cpu_stat));
+		align_string(cpu_stat, 14, 20);
+		snprintf(wakes, sizeof(wakes), "%5.1f", all_cgroups[i]->wake_ups / measurement_time);
+		align_string(wakes, 11, 20);
+		snprintf(disks, sizeof(disks), "%5.1f", all_cgroups[i]->disk_hits / measurement_time);
+		align_string(disks, 11, 20);
+
+		wprintw(win, "%s  %s %s %s %s %s\n", power, usage, cpu_stat, wakes, disks,
+			pretty_print(all_cgroups[i]->description(), descr, 128));
+	}
+}
+
+void report_cgroup_update_display(void)
+{
+	unsigned int i, total;
+	int show_power, cols, rows, idx;
+
+	if (all_cgroups.empty())
+		return;
+
+	/* div attr css_class and css_id */
+	tag_attr div_attr;
+	init_div(&div_attr, "clear_block", "cgroups");
+
+	sort(all_cgroups.begin(), all_cgroups.end(), cgroup_sort);
+	show_power = global_power_valid();
+
+	cols = 7;
+	if (show_power)
+		cols = 8;
+
+	total = all_cgroups.size();
+	if (total > 100)
+		total = 100;
+
+	rows = total + 1;
+	table_attributes std_table_css;
+	init_nowarp_table_attr(&std_table_css, rows, cols);
+
+	tag_attr title_attr;
+	init_title_attr(&title_attr);
+
+	string *cgroup_data = new string[cols * rows];
+	cgroup_data[0] = __("Usage");
+	cgroup_data[1] = __("cpu.stat");
+	cgroup_data[2] = __("Wakeups/s");
+	cgroup_data[3] = __("Disk IO/s");
+	cgroup_data[4] = __("GPU ops/s");
+	cgroup_data[5] = __("Processes");
+	cgroup_data[6] = __("Cgroup");
+	if (show_power)
+		cgroup_data[7] = __("PW Estimate");
+
+	idx = cols;
+	for (i = 0; i < total; i++) {
+		class cgroup_consumer *group = all_cgroups[i];
+		char power[16];
+		char usage[20];
+		char cpu_stat[20];
+		char wakes[20];
+		char disks[20];
+		char gpus[20];
+		char procs[20];
+
+		format_usage(group, usage, sizeof(usage));
+		format_cpu_stat(group, cpu_stat, sizeof(cpu_stat));
+		snprintf(wakes, sizeof(wakes), "%5.1f", group->wake_ups / measurement_time);
+		snprintf(disks, sizeof(disks), "%5.1f (%5.1f)", group->hard_disk_hits / measurement_time,
+				group->disk_hits / measurement_time);
+		snprintf(gpus, sizeof(gpus), "%5.1f", group->gpu_ops / measurement_time);
+		snprintf(procs, sizeof(procs), "%i", group->processes);
+		if (group->wake_ups == 0)
+			wakes[0] = 0;
+		if (group->disk_hits == 0)
+			disks[0] = 0;
+		if (group->gpu_ops == 0)
+			gpus[0] = 0;
+
+		cgroup_data[idx++] = string(usage);
+		cgroup_data[idx++] = string(cpu_stat);
+		cgroup_data[idx++] = string(wakes);
+		cgroup_data[idx++] = string(disks);
+		cgroup_data[idx++] = string(gpus);
+		cgroup_data[idx++] = string(procs);
+		cgroup_data[idx++] = string(group->description());
+		if (show_power) {
+			format_watts(group->Witts(), power, 10);
+			cgroup_data[idx++] = string(power);
+		}
+	}
+
+	report.add_div(&div_attr);
+	report.add_title(&title_attr, __("Power Consumers by Cgroup"));
+	report.add_table(cgroup_data, &std_table_css);
+	report.end_div();
+	delete [] cgroup_data;
+}
@@ -0,0 +1,65 @@
+/*
+ * Copyright 2010, Intel Corporation
+ *
+ * This file is part of PowerTOP
+ *
+ * This program file is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; version 2 of the License.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program in a file named COPYING; if not, write to the
+ * Free Software Foundation, Inc,
+ * 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1301 USA
+ * or just google for it.
+ *
+ * Authors:
+ *	Arjan van de Ven <arjan@linux.intel.com>
+ */
+#ifndef _INCLUDE_GUARD_CGROUP_H
+#define _INCLUDE_GUARD_CGROUP_H
+
+#include <stdint.h>
+#include <string>
+
+#include "powerconsumer.h"
+
+/*
+ * The processes of one cgroup v2 added up. These are not in all_power,
+ * the processes themselves already are; they only show up in their own
+ * tab and report section.
+ */
+class cgroup_consumer : public power_consumer {
+public:
+	int		id;
+	int		processes;
+
+	cgroup_consumer(int _id);
+
+	virtual const char * description(void);
+	virtual const char * name(void) { return "cgroup"; };
+	virtual const char * type(void) { return "Cgroup"; };
+
+	/* runtime according to the cgroup's cpu.stat, < 0 if not known */
+	double cpu_stat_usage(void);
+};
+
+/* id of a cgroup path, valid until the next start_cgroup_measurement() */
+extern int cgroup_id(const string &path);
+
+extern void start_cgroup_measurement(void);
+extern void end_cgroup_measurement(void);
+
+extern void account_cgroups(void);
+extern void clear_cgroups(void);
+
+extern void cgroup_update_display(void);
+extern void report_cgroup_update_display(void);
+
+#endif
@@ -38,12 +38,15 @@
 #include <stack>
 
 #include <stdio.h>
+#include <stdint.h>
 #include <string.h>
 #ifndef _WIN32
 #include <ncurses.h>
 #endif
 
 #include "../perf/perf_bundle.h"
+#include "pid_cache.h"
+#include "cgroup.h"
 #ifndef _WIN32
 #include "../perf/perf_event.h"
 #endif
@@ -51,15 +54,52 @@
 #include "../display.h"
 #include "../measurement/measurement.h"
 
+extern int debug_learning;
+
 static  class perf_bundle * perf_events;
 
 vector <class power_consumer *> all_power;
 
-vector< vector<class power_consumer *> > cpu_stack;
+/* deeper than interrupts, softirqs, timers and work ever nest */
+#define CONSUMER_STACK_DEPTH	14
+#define CACHE_LINE		64
 
-vector<int> cpu_level;
-vector<int> cpu_credit;
-vector<class power_consumer *> cpu_blame;
+/*
+ * What the handlers below track per cpu, each cpu on cache lines of its
+ * own. The table is sized from the topology once per interval, with one
+ * spare slot at the end for samples from cpus that came online since.
+ */
+struct cpu_state {
+	class power_consumer	*stack[CONSUMER_STACK_DEPTH];
+	class power_consumer	*blame;
+	int			depth;	/* can exceed CONSUMER_STACK_DEPTH, see push_consumer() */
+	int			level;
+	int			credit;
+} __attribute__((aligned(CACHE_LINE)));
+
+static struct cpu_state boot_cpu_state;
+static struct cpu_state *cpu_states = &boot_cpu_state;
+static unsigned int nr_cpu_states;
+static char *cpu_state_mem;
+
+static inline struct cpu_state *cpu_state(unsigned int cpu)
+{
+	return &cpu_states[cpu < nr_cpu_states ? cpu : nr_cpu_states];
+}
+
+static void size_cpu_states(unsigned int nr)
+{
+	uintptr_t base;
+
+	if (nr != nr_cpu_states || !cpu_state_mem) {
+		delete [] cpu_state_mem;
+		cpu_state_mem = new char[(nr + 1) * sizeof(struct cpu_state) + CACHE_LINE];
+		base = ((uintptr_t)cpu_state_mem + CACHE_LINE - 1) & ~(uintptr_t)(CACHE_LINE - 1);
+		cpu_states = (struct cpu_state *)base;
+		nr_cpu_states = nr;
+	}
+	memset(cpu_states, 0, (nr_cpu_states + 1) * sizeof(struct cpu_state));
+}
 
 #define LEVEL_HARDIRQ	1
 #define LEVEL_SOFTIRQ	2
@@ -72,112 +112,99 @@ static uint64_t first_stamp, last_stamp;
 
 double measurement_time;
 
+/*
+ * A full stack keeps counting pushes without storing them, so that the
+ * pops still pair up; until then the deepest stored entry stays current.
+ */
 static void push_consumer(unsigned int cpu, class power_consumer *consumer)
 {
-	if (cpu_stack.size() <= cpu)
-		cpu_stack.resize(cpu + 1);
-	cpu_stack[cpu].push_back(consumer);
+	struct cpu_state *state = cpu_state(cpu);
+
+	if (state->depth < CONSUMER_STACK_DEPTH)
+		state->stack[state->depth] = consumer;
+	state->depth++;
 }
 
 static void pop_consumer(unsigned int cpu)
 {
-	if (cpu_stack.size() <= cpu)
-		cpu_stack.resize(cpu + 1);
+	struct cpu_state *state = cpu_state(cpu);
 
-	if (cpu_stack[cpu].size())
-		cpu_stack[cpu].resize(cpu_stack[cpu].size()-1);
+	if (state->depth)
+		state->depth--;
 }
 
 static int consumer_depth(unsigned int cpu)
 {
-	if (cpu_stack.size() <= cpu)
-		cpu_stack.resize(cpu + 1);
-	return cpu_stack[cpu].size();
+	return cpu_state(cpu)->depth;
 }
 
 static class power_consumer *current_consumer(unsigned int cpu)
 {
-	if (cpu_stack.size() <= cpu)
-		cpu_stack.resize(cpu + 1);
-	if (cpu_stack[cpu].size())
-
-		return cpu_stack[cpu][cpu_stack[cpu].size()-1];
+	struct cpu_state *state = cpu_state(cpu);
 
-	return NULL;
+	if (!state->depth)
+		return NULL;
+	return state->stack[min(state->depth, CONSUMER_STACK_DEPTH) - 1];
 }
 
 static void clear_consumers(void)
 {
 	unsigned int i;
-	for (i = 0; i < cpu_stack.size(); i++)
-		cpu_stack[i].resize(0);
+	for (i = 0; i <= nr_cpu_states; i++)
+		cpu_states[i].depth = 0;
 }
 
 static void consumer_child_time(unsigned int cpu, uint64_t time)
 {
-	unsigned int i;
-	if (cpu_stack.size() <= cpu)
-		cpu_stack.resize(cpu + 1);
-	for (i = 0; i < cpu_stack[cpu].size(); i++)
-		cpu_stack[cpu][i]->child_runtime += time;
+	struct cpu_state *state = cpu_state(cpu);
+	int i;
+
+	for (i = 0; i < min(state->depth, CONSUMER_STACK_DEPTH); i++)
+		state->stack[i]->child_runtime += time;
 }
 
 static void set_wakeup_pending(unsigned int cpu)
 {
-	if (cpu_credit.size() <= cpu)
-		cpu_credit.resize(cpu + 1);
-
-	cpu_credit[cpu] = 1;
+	cpu_state(cpu)->credit = 1;
 }
 
 static void clear_wakeup_pending(unsigned int cpu)
 {
-	if (cpu_credit.size() <= cpu)
-		cpu_credit.resize(cpu + 1);
-
-	cpu_credit[cpu] = 0;
+	cpu_state(cpu)->credit = 0;
 }
 
 static int get_wakeup_pending(unsigned int cpu)
 {
-	if (cpu_credit.size() <= cpu)
-		cpu_credit.resize(cpu + 1);
-	return cpu_credit[cpu];
+	return cpu_state(cpu)->credit;
 }
 
 static void change_blame(unsigned int cpu, class power_consumer *consumer, int level)
 {
-	if (cpu_level[cpu] >= level)
+	struct cpu_state *state = cpu_state(cpu);
+
+	if (state->level >= level)
 		return;
-	cpu_blame[cpu] = consumer;
-	cpu_level[cpu] = level;
+	state->blame = consumer;
+	state->level = level;
 }
 
 static void consume_blame(unsigned int cpu)
 {
+	struct cpu_state *state;
+
 	if (!get_wakeup_pending(cpu))
 		return;
-	if (cpu_level.size() <= cpu)
-		return;
-	if (cpu_blame.size() <= cpu)
-		return;
-	if (!cpu_blame[cpu])
+	state = cpu_state(cpu);
+	if (!state->blame)
 		return;
 
-	cpu_blame[cpu]->wake_ups++;
-	cpu_blame[cpu] = NULL;
-	cpu_level[cpu] = 0;
+	state->blame->wake_ups++;
+	state->blame = NULL;
+	state->level = 0;
 	clear_wakeup_pending(cpu);
 }
 
 
-#ifndef _WIN32
-class perf_process_bundle: public perf_bundle
-{
-	virtual void handle_trace_point(void *trace, int cpu, uint64_t time);
-};
-#endif /* !_WIN32 */
-
 static bool comm_is_xorg(char *comm)
 {
 	return strcmp(comm, "Xorg") == 0 || strcmp(comm, "X") == 0;
@@ -196,36 +223,8 @@ int dont_blame_me(char *comm)
 
 #ifndef _WIN32 /* Linux-only: perf/tep process tracking functions */
 
-static char * get_tep_field_str(void *trace, struct tep_event *event, struct tep_format_field *field)
+static void track_stamp(uint64_t time)
 {
-	unsigned long long offset, len;
-	if (field->flags & TEP_FIELD_IS_DYNAMIC) {
-		offset = field->offset;
-		len = field->size;
-		offset = tep_read_number(event->tep, (char *)trace + offset, len);
-		offset &= 0xffff;
-		return (char *)trace + offset;
-	}
-	/** no __data_loc field type*/
-	return (char *)trace + field->offset;
-}
-
-void perf_process_bundle::handle_trace_point(void *trace, int cpu, uint64_t time)
-{
-	struct tep_event *event;
-	struct tep_record rec; /* holder */
-	struct tep_format_field *field;
-	unsigned long long val;
-	int type;
-	int ret;
-
-	rec.data = trace;
-
-	type = tep_data_type(perf_event::tep, &rec);
-	event = tep_find_event(perf_event::tep, type);
-	if (!event)
-		return;
-
 	if (time < first_stamp)
 		first_stamp = time;
 
@@ -233,469 +232,517 @@ void perf_process_bundle::handle_trace_point(void *trace, int cpu, uint64_t time
 		last_stamp = time;
 		measurement_time = (0.0001 + last_stamp - first_stamp) / 1000000000 ;
 	}
+}
+
+static int in_interrupt(class trace_decoder *decoder, void *trace, int field)
+{
+	int flags;
 
-	if (strcmp(event->name, "sched_switch") == 0) {
-		class process *old_proc = NULL;
-		class process *new_proc  = NULL;
-		const char *next_comm;
-		int next_pid;
-		int prev_pid;
+	flags = (int)decoder->value(trace, field);
+	return (flags & TRACE_FLAG_HARDIRQ) || (flags & TRACE_FLAG_SOFTIRQ);
+}
 
-		field = tep_find_any_field(event, "next_comm");
-		if (!field || !(field->flags & TEP_FIELD_IS_STRING))
-			return; /* ?? */
+enum { SWITCH_NEXT_COMM, SWITCH_NEXT_PID, SWITCH_PREV_PID };
+static const char * const sched_switch_fields[] = { "next_comm", "next_pid", "prev_pid", NULL };
 
-		next_comm = get_tep_field_str(trace, event, field);
+static void handle_sched_switch(class trace_decoder *decoder, void *trace, int cpu, uint64_t time)
+{
+	class process *old_proc = NULL;
+	class process *new_proc  = NULL;
+	const char *next_comm;
+	int next_pid;
+	int prev_pid;
 
-		ret = tep_get_field_val(NULL, event, "next_pid", &rec, &val, 0);
-		if (ret < 0)
-			return;
-		next_pid = (int)val;
+	track_stamp(time);
 
-		ret = tep_get_field_val(NULL, event, "prev_pid", &rec, &val, 0);
-		if (ret < 0)
-			return;
-		prev_pid = (int)val;
+	next_comm = decoder->str(trace, SWITCH_NEXT_COMM);
+	if (!next_comm)
+		return; /* ?? */
 
-		/* find new process pointer */
-		new_proc = find_create_process(next_comm, next_pid);
+	if (!decoder->has(SWITCH_NEXT_PID) || !decoder->has(SWITCH_PREV_PID))
+		return;
+	next_pid = (int)decoder->value(trace, SWITCH_NEXT_PID);
+	prev_pid = (int)decoder->value(trace, SWITCH_PREV_PID);
 
-		/* find the old process pointer */
+	/* find new process pointer */
+	new_proc = find_create_process(next_comm, next_pid);
 
-		while  (consumer_depth(cpu) > 1) {
-			pop_consumer(cpu);
-		}
+	/* find the old process pointer */
 
-		if (consumer_depth(cpu) == 1)
-			old_proc = (class process *)current_consumer(cpu);
+	while  (consumer_depth(cpu) > 1) {
+		pop_consumer(cpu);
+	}
 
-		if (old_proc && strcmp(old_proc->name(), "process"))
-			old_proc = NULL;
+	if (consumer_depth(cpu) == 1)
+		old_proc = (class process *)current_consumer(cpu);
 
-		/* retire the old process */
+	if (old_proc && strcmp(old_proc->name(), "process"))
+		old_proc = NULL;
 
-		if (old_proc) {
-			old_proc->deschedule_thread(time, prev_pid);
-			old_proc->waker = NULL;
-		}
+	/* retire the old process */
 
-		if (consumer_depth(cpu))
-			pop_consumer(cpu);
+	if (old_proc) {
+		old_proc->deschedule_thread(time, prev_pid);
+		old_proc->waker = NULL;
+	}
 
-		push_consumer(cpu, new_proc);
+	if (consumer_depth(cpu))
+		pop_consumer(cpu);
 
-		/* start new process */
-		new_proc->schedule_thread(time, next_pid);
+	push_consumer(cpu, new_proc);
 
-		if (strncmp(next_comm,"migration/", 10) && strncmp(next_comm,"kworker/", 8) && strncmp(next_comm, "kondemand/",10)) {
-			if (next_pid) {
-				/* If someone woke us up.. blame him instead */
-				if (new_proc->waker) {
-					change_blame(cpu, new_proc->waker, LEVEL_PROCESS);
-				} else {
-					change_blame(cpu, new_proc, LEVEL_PROCESS);
-				}
-			}
+	/* start new process */
+	new_proc->schedule_thread(time, next_pid);
 
-			consume_blame(cpu);
-		}
-		new_proc->waker = NULL;
-	}
-	else if (strcmp(event->name, "sched_wakeup") == 0) {
-		class power_consumer *from = NULL;
-		class process *dest_proc = NULL;
-		class process *from_proc = NULL;
-		const char *comm;
-		int flags;
-		int pid;
-
-		ret = tep_get_common_field_val(NULL, event, "common_flags", &rec, &val, 0);
-		if (ret < 0)
-			return;
-		flags = (int)val;
-
-		if ( (flags & TRACE_FLAG_HARDIRQ) || (flags & TRACE_FLAG_SOFTIRQ)) {
-			class timer *timer;
-			timer = (class timer *) current_consumer(cpu);
-			if (timer && strcmp(timer->name(), "timer")==0) {
-				if (strcmp(timer->handler, "delayed_work_timer_fn") &&
-				    strcmp(timer->handler, "hrtimer_wakeup") &&
-				    strcmp(timer->handler, "it_real_fn"))
-					from = timer;
+	if (strncmp(next_comm,"migration/", 10) && strncmp(next_comm,"kworker/", 8) && strncmp(next_comm, "kondemand/",10)) {
+		if (next_pid) {
+			/* If someone woke us up.. blame him instead */
+			if (new_proc->waker) {
+				change_blame(cpu, new_proc->waker, LEVEL_PROCESS);
+			} else {
+				change_blame(cpu, new_proc, LEVEL_PROCESS);
 			}
-			/* woken from interrupt */
-			/* TODO: find the current irq handler and set "from" to that */
-		} else {
-			from = current_consumer(cpu);
 		}
 
+		consume_blame(cpu);
+	}
+	new_proc->waker = NULL;
+}
 
-		field = tep_find_any_field(event, "comm");
-
-		if (!field || !(field->flags & TEP_FIELD_IS_STRING))
- 			return;
+enum { WAKEUP_FLAGS, WAKEUP_COMM, WAKEUP_PID };
+static const char * const sched_wakeup_fields[] = { "common_flags", "comm", "pid", NULL };
 
-		comm = get_tep_field_str(trace, event, field);
+static void handle_sched_wakeup(class trace_decoder *decoder, void *trace, int cpu, uint64_t time)
+{
+	class power_consumer *from = NULL;
+	class process *dest_proc = NULL;
+	class process *from_proc = NULL;
+	const char *comm;
+	int pid;
 
-		ret = tep_get_field_val(NULL, event, "pid", &rec, &val, 0);
-		if (ret < 0)
-			return;
-		pid = (int)val;
+	track_stamp(time);
 
-		dest_proc = find_create_process(comm, pid);
+	if (!decoder->has(WAKEUP_FLAGS))
+		return;
 
-		if (from && strcmp(from->name(), "process")!=0){
-			/* not a process doing the wakeup */
-			from = NULL;
-			from_proc = NULL;
-		} else {
-			from_proc = (class process *) from;
+	if (in_interrupt(decoder, trace, WAKEUP_FLAGS)) {
+		class timer *timer;
+		timer = (class timer *) current_consumer(cpu);
+		if (timer && strcmp(timer->name(), "timer")==0) {
+			if (strcmp(timer->handler, "delayed_work_timer_fn") &&
+			    strcmp(timer->handler, "hrtimer_wakeup") &&
+			    strcmp(timer->handler, "it_real_fn"))
+				from = timer;
 		}
+		/* woken from interrupt */
+		/* TODO: find the current irq handler and set "from" to that */
+	} else {
+		from = current_consumer(cpu);
+	}
 
-		if (from_proc && (dest_proc->running == 0) && (dest_proc->waker == NULL) && (pid != 0) && !dont_blame_me(from_proc->comm))
-			dest_proc->waker = from;
-		if (from)
-			dest_proc->last_waker = from;
+	comm = decoder->str(trace, WAKEUP_COMM);
+	if (!comm)
+		return;
 
-		/* Account processes that wake up X specially */
-		if (from && dest_proc && comm_is_xorg(dest_proc->comm))
-			from->xwakes ++ ;
+	if (!decoder->has(WAKEUP_PID))
+		return;
+	pid = (int)decoder->value(trace, WAKEUP_PID);
 
+	dest_proc = find_create_process(comm, pid);
+
+	if (from && strcmp(from->name(), "process")!=0){
+		/* not a process doing the wakeup */
+		from = NULL;
+		from_proc = NULL;
+	} else {
+		from_proc = (class process *) from;
 	}
-	else if (strcmp(event->name, "irq_handler_entry") == 0) {
-		class interrupt *irq = NULL;
-		const char *handler;
-		int nr;
 
-		field = tep_find_any_field(event, "name");
-		if (!field || !(field->flags & TEP_FIELD_IS_STRING))
-			return; /* ?? */
+	if (from_proc && (dest_proc->running == 0) && (dest_proc->waker == NULL) && (pid != 0) && !dont_blame_me(from_proc->comm))
+		dest_proc->waker = from;
+	if (from)
+		dest_proc->last_waker = from;
 
-		handler = get_tep_field_str(trace, event, field);
+	/* Account processes that wake up X specially */
+	if (from && dest_proc && comm_is_xorg(dest_proc->comm))
+		from->xwakes ++ ;
+}
 
-		ret = tep_get_field_val(NULL, event, "irq", &rec, &val, 0);
-		if (ret < 0)
-			return;
-		nr = (int)val;
+enum { IRQ_NAME, IRQ_NR };
+static const char * const irq_handler_entry_fields[] = { "name", "irq", NULL };
 
-		irq = find_create_interrupt(handler, nr, cpu);
+static void handle_irq_handler_entry(class trace_decoder *decoder, void *trace, int cpu, uint64_t time)
+{
+	class interrupt *irq = NULL;
+	const char *handler;
+	int nr;
 
+	track_stamp(time);
 
-		push_consumer(cpu, irq);
+	handler = decoder->str(trace, IRQ_NAME);
+	if (!handler)
+		return; /* ?? */
 
-		irq->start_interrupt(time);
+	if (!decoder->has(IRQ_NR))
+		return;
+	nr = (int)decoder->value(trace, IRQ_NR);
 
-		if (strstr(irq->handler, "timer") ==NULL)
-			change_blame(cpu, irq, LEVEL_HARDIRQ);
+	irq = find_create_interrupt(handler, nr, cpu);
 
-	}
+	push_consumer(cpu, irq);
 
-	else if (strcmp(event->name, "irq_handler_exit") == 0) {
-		class interrupt *irq = NULL;
-		uint64_t t;
+	irq->start_interrupt(time);
 
-		/* find interrupt (top of stack) */
-		irq = (class interrupt *)current_consumer(cpu);
-		if (!irq || strcmp(irq->name(), "interrupt"))
-			return;
-		pop_consumer(cpu);
-		/* retire interrupt */
-		t = irq->end_interrupt(time);
-		consumer_child_time(cpu, t);
+	if (strstr(irq->handler, "timer") ==NULL)
+		change_blame(cpu, irq, LEVEL_HARDIRQ);
+}
+
+/* irq_handler_exit and softirq_exit */
+static void handle_irq_exit(class trace_decoder *decoder, void *trace, int cpu, uint64_t time)
+{
+	class interrupt *irq = NULL;
+	uint64_t t;
+
+	track_stamp(time);
+
+	/* find interrupt (top of stack) */
+	irq = (class interrupt *)current_consumer(cpu);
+	if (!irq || strcmp(irq->name(), "interrupt"))
+		return;
+	pop_consumer(cpu);
+	/* retire interrupt */
+	t = irq->end_interrupt(time);
+	consumer_child_time(cpu, t);
+}
+
+enum { SOFTIRQ_VEC };
+static const char * const softirq_entry_fields[] = { "vec", NULL };
+
+static void handle_softirq_entry(class trace_decoder *decoder, void *trace, int cpu, uint64_t time)
+{
+	class interrupt *irq = NULL;
+	const char *handler = NULL;
+	int vec;
+
+	track_stamp(time);
+
+	if (!decoder->has(SOFTIRQ_VEC)) {
+		fprintf(stderr, "softirq_entry event returned no vector number?\n");
+		return;
 	}
+	vec = (int)decoder->value(trace, SOFTIRQ_VEC);
 
-	else if (strcmp(event->name, "softirq_entry") == 0) {
-		class interrupt *irq = NULL;
-		const char *handler = NULL;
-		int vec;
+	if (vec <= 9)
+		handler = softirqs[vec];
 
-		ret = tep_get_field_val(NULL, event, "vec", &rec, &val, 0);
-                if (ret < 0) {
-                        fprintf(stderr, "softirq_entry event returned no vector number?\n");
-                        return;
-                }
-		vec = (int)val;
+	if (!handler)
+		return;
 
-		if (vec <= 9)
-			handler = softirqs[vec];
+	irq = find_create_interrupt(handler, vec, cpu);
 
-		if (!handler)
-			return;
+	push_consumer(cpu, irq);
 
-		irq = find_create_interrupt(handler, vec, cpu);
+	irq->start_interrupt(time);
+	change_blame(cpu, irq, LEVEL_SOFTIRQ);
+}
 
-		push_consumer(cpu, irq);
+enum { TIMER_FUNCTION, TIMER_TIMER };
+static const char * const timer_expire_entry_fields[] = { "function", "timer", NULL };
 
-		irq->start_interrupt(time);
-		change_blame(cpu, irq, LEVEL_SOFTIRQ);
+static void handle_timer_expire_entry(class trace_decoder *decoder, void *trace, int cpu, uint64_t time)
+{
+	class timer *timer = NULL;
+	uint64_t function;
+	uint64_t tmr;
+
+	track_stamp(time);
+
+	if (!decoder->has(TIMER_FUNCTION)) {
+		fprintf(stderr, "timer_expire_entry event returned no function value?\n");
+		return;
 	}
-	else if (strcmp(event->name, "softirq_exit") == 0) {
-		class interrupt *irq = NULL;
-		uint64_t t;
+	function = decoder->value(trace, TIMER_FUNCTION);
 
-		irq = (class interrupt *) current_consumer(cpu);
-		if (!irq  || strcmp(irq->name(), "interrupt"))
-			return;
-		pop_consumer(cpu);
-		/* pop irq */
-		t = irq->end_interrupt(time);
-		consumer_child_time(cpu, t);
+	timer = find_create_timer(function);
+
+	if (timer->is_deferred())
+		return;
+
+	if (!decoder->has(TIMER_TIMER)) {
+		fprintf(stderr, "softirq_entry event returned no timer ?\n");
+		return;
 	}
-	else if (strcmp(event->name, "timer_expire_entry") == 0) {
-		class timer *timer = NULL;
-		uint64_t function;
-		uint64_t tmr;
-
-		ret = tep_get_field_val(NULL, event, "function", &rec, &val, 0);
-		if (ret < 0) {
-			fprintf(stderr, "timer_expire_entry event returned no function value?\n");
-			return;
-		}
-		function = (uint64_t)val;
+	tmr = decoder->value(trace, TIMER_TIMER);
 
-		timer = find_create_timer(function);
+	push_consumer(cpu, timer);
+	timer->fire(time, tmr);
 
-		if (timer->is_deferred())
-			return;
+	if (strcmp(timer->handler, "delayed_work_timer_fn"))
+		change_blame(cpu, timer, LEVEL_TIMER);
+}
 
-		ret = tep_get_field_val(NULL, event, "timer", &rec, &val, 0);
-		if (ret < 0) {
-			fprintf(stderr, "softirq_entry event returned no timer ?\n");
-			return;
-		}
-		tmr = (uint64_t)val;
+enum { TIMER_EXIT_TIMER };
+static const char * const timer_expire_exit_fields[] = { "timer", NULL };
+static const char * const hrtimer_expire_exit_fields[] = { "hrtimer", NULL };
 
-		push_consumer(cpu, timer);
-		timer->fire(time, tmr);
+/* timer_expire_exit and hrtimer_expire_exit */
+static void handle_timer_expire_exit(class trace_decoder *decoder, void *trace, int cpu, uint64_t time)
+{
+	class timer *timer = NULL;
+	uint64_t tmr;
+	uint64_t t;
 
-		if (strcmp(timer->handler, "delayed_work_timer_fn"))
-			change_blame(cpu, timer, LEVEL_TIMER);
-	}
-	else if (strcmp(event->name, "timer_expire_exit") == 0) {
-		class timer *timer = NULL;
-		uint64_t tmr;
-		uint64_t t;
+	track_stamp(time);
 
-		ret = tep_get_field_val(NULL, event, "timer", &rec, &val, 0);
-		if (ret < 0)
-			return;
-		tmr = (uint64_t)val;
+	if (!decoder->has(TIMER_EXIT_TIMER))
+		return;
+	tmr = decoder->value(trace, TIMER_EXIT_TIMER);
 
-		timer = (class timer *) current_consumer(cpu);
-		if (!timer || strcmp(timer->name(), "timer")) {
-			return;
-		}
-		pop_consumer(cpu);
+	timer = (class timer *) current_consumer(cpu);
+	if (!timer || strcmp(timer->name(), "timer")) {
+		return;
+	}
+	pop_consumer(cpu);
+	t = timer->done(time, tmr);
+	if (t == ~0ULL) {
+		timer->fire(first_stamp, tmr);
 		t = timer->done(time, tmr);
-		if (t == ~0ULL) {
-			timer->fire(first_stamp, tmr);
-			t = timer->done(time, tmr);
-		}
-		consumer_child_time(cpu, t);
 	}
-	else if (strcmp(event->name, "hrtimer_expire_entry") == 0) {
-		class timer *timer = NULL;
-		uint64_t function;
-		uint64_t tmr;
+	consumer_child_time(cpu, t);
+}
 
-		ret = tep_get_field_val(NULL, event, "function", &rec, &val, 0);
-		if (ret < 0)
-			return;
-		function = (uint64_t)val;
+static const char * const hrtimer_expire_entry_fields[] = { "function", "hrtimer", NULL };
 
-		timer = find_create_timer(function);
+static void handle_hrtimer_expire_entry(class trace_decoder *decoder, void *trace, int cpu, uint64_t time)
+{
+	class timer *timer = NULL;
+	uint64_t function;
+	uint64_t tmr;
 
-		ret = tep_get_field_val(NULL, event, "hrtimer", &rec, &val, 0);
-		if (ret < 0)
-			return;
-		tmr = (uint64_t)val;
+	track_stamp(time);
 
-		push_consumer(cpu, timer);
-		timer->fire(time, tmr);
+	if (!decoder->has(TIMER_FUNCTION))
+		return;
+	function = decoder->value(trace, TIMER_FUNCTION);
 
-		if (strcmp(timer->handler, "delayed_work_timer_fn"))
-			change_blame(cpu, timer, LEVEL_TIMER);
-	}
-	else if (strcmp(event->name, "hrtimer_expire_exit") == 0) {
-		class timer *timer = NULL;
-		uint64_t tmr;
-		uint64_t t;
+	timer = find_create_timer(function);
 
-		timer = (class timer *) current_consumer(cpu);
-		if (!timer || strcmp(timer->name(), "timer")) {
-			return;
-		}
+	if (!decoder->has(TIMER_TIMER))
+		return;
+	tmr = decoder->value(trace, TIMER_TIMER);
 
-		ret = tep_get_field_val(NULL, event, "hrtimer", &rec, &val, 0);
-		if (ret < 0)
-			return;
-		tmr = (uint64_t)val;
+	push_consumer(cpu, timer);
+	timer->fire(time, tmr);
 
-		pop_consumer(cpu);
-		t = timer->done(time, tmr);
-		if (t == ~0ULL) {
-			timer->fire(first_stamp, tmr);
-			t = timer->done(time, tmr);
-		}
-		consumer_child_time(cpu, t);
-	}
-	else if (strcmp(event->name, "workqueue_execute_start") == 0) {
-		class work *work = NULL;
-		uint64_t function;
-		uint64_t wk;
+	if (strcmp(timer->handler, "delayed_work_timer_fn"))
+		change_blame(cpu, timer, LEVEL_TIMER);
+}
+
+enum { WORK_WORK, WORK_FUNCTION };
+static const char * const workqueue_execute_start_fields[] = { "work", "function", NULL };
+
+static void handle_workqueue_execute_start(class trace_decoder *decoder, void *trace, int cpu, uint64_t time)
+{
+	class work *work = NULL;
+	uint64_t function;
+	uint64_t wk;
+
+	track_stamp(time);
+
+	if (!decoder->has(WORK_FUNCTION) || !decoder->has(WORK_WORK))
+		return;
+	function = decoder->value(trace, WORK_FUNCTION);
+	wk = decoder->value(trace, WORK_WORK);
+
+	work = find_create_work(function);
+
+
+	push_consumer(cpu, work);
+	work->fire(time, wk);
 
-		ret = tep_get_field_val(NULL, event, "function", &rec, &val, 0);
-		if (ret < 0)
-			return;
-		function = (uint64_t)val;
 
-		ret = tep_get_field_val(NULL, event, "work", &rec, &val, 0);
-		if (ret < 0)
-			return;
-		wk = (uint64_t)val;
+	if (strcmp(work->handler, "do_dbs_timer") != 0 && strcmp(work->handler, "vmstat_update") != 0)
+		change_blame(cpu, work, LEVEL_WORK);
+}
 
-		work = find_create_work(function);
+static const char * const workqueue_execute_end_fields[] = { "work", NULL };
 
+static void handle_workqueue_execute_end(class trace_decoder *decoder, void *trace, int cpu, uint64_t time)
+{
+	class work *work = NULL;
+	uint64_t t;
+	uint64_t wk;
 
-		push_consumer(cpu, work);
-		work->fire(time, wk);
+	track_stamp(time);
 
+	if (!decoder->has(WORK_WORK))
+		return;
+	wk = decoder->value(trace, WORK_WORK);
 
-		if (strcmp(work->handler, "do_dbs_timer") != 0 && strcmp(work->handler, "vmstat_update") != 0)
-			change_blame(cpu, work, LEVEL_WORK);
+	work = (class work *) current_consumer(cpu);
+	if (!work || strcmp(work->name(), "work")) {
+		return;
 	}
-	else if (strcmp(event->name, "workqueue_execute_end") == 0) {
-		class work *work = NULL;
-		uint64_t t;
-		uint64_t wk;
-
-		ret = tep_get_field_val(NULL, event, "work", &rec, &val, 0);
-		if (ret < 0)
-			return;
-		wk = (uint64_t)val;
-
-		work = (class work *) current_consumer(cpu);
-		if (!work || strcmp(work->name(), "work")) {
-			return;
-		}
-		pop_consumer(cpu);
+	pop_consumer(cpu);
+	t = work->done(time, wk);
+	if (t == ~0ULL) {
+		work->fire(first_stamp, wk);
 		t = work->done(time, wk);
-		if (t == ~0ULL) {
-			work->fire(first_stamp, wk);
-			t = work->done(time, wk);
-		}
-		consumer_child_time(cpu, t);
 	}
-	else if (strcmp(event->name, "cpu_idle") == 0) {
-		tep_get_field_val(NULL, event, "state", &rec, &val, 0);
-		if (val == (unsigned int)-1)
-			consume_blame(cpu);
-		else
-			set_wakeup_pending(cpu);
-	}
-	else if (strcmp(event->name, "power_start") == 0) {
-		set_wakeup_pending(cpu);
-	}
-	else if (strcmp(event->name, "power_end") == 0) {
+	consumer_child_time(cpu, t);
+}
+
+enum { IDLE_STATE };
+static const char * const cpu_idle_fields[] = { "state", NULL };
+
+static void handle_cpu_idle(class trace_decoder *decoder, void *trace, int cpu, uint64_t time)
+{
+	uint64_t val = 0;
+
+	track_stamp(time);
+
+	if (decoder->has(IDLE_STATE))
+		val = decoder->value(trace, IDLE_STATE);
+	if (val == (unsigned int)-1)
 		consume_blame(cpu);
+	else
+		set_wakeup_pending(cpu);
+}
+
+static void handle_power_start(class trace_decoder *decoder, void *trace, int cpu, uint64_t time)
+{
+	track_stamp(time);
+	set_wakeup_pending(cpu);
+}
+
+static void handle_power_end(class trace_decoder *decoder, void *trace, int cpu, uint64_t time)
+{
+	track_stamp(time);
+	consume_blame(cpu);
+}
+
+enum { I915_FLAGS };
+static const char * const i915_fields[] = { "common_flags", NULL };
+
+/*
+ * any kernel contains only one of i915_gem_ring_dispatch and
+ * i915_gem_request_submit, the latter one got replaced by the former one
+ */
+static void handle_i915_request(class trace_decoder *decoder, void *trace, int cpu, uint64_t time)
+{
+	class power_consumer *consumer = NULL;
+
+	track_stamp(time);
+
+	if (!decoder->has(I915_FLAGS))
+		return;
+
+	consumer = current_consumer(cpu);
+	/* currently we don't count graphic requests submitted from irq contect */
+	if (in_interrupt(decoder, trace, I915_FLAGS)) {
+		consumer = NULL;
 	}
-	else if (strcmp(event->name, "i915_gem_ring_dispatch") == 0
-	 || strcmp(event->name, "i915_gem_request_submit") == 0) {
-		/* any kernel contains only one of the these tracepoints,
-		 * the latter one got replaced by the former one */
-		class power_consumer *consumer = NULL;
-		int flags;
-
-		ret = tep_get_common_field_val(NULL, event, "common_flags", &rec, &val, 0);
-		if (ret < 0)
-			return;
-		flags = (int)val;
-
-		consumer = current_consumer(cpu);
-		/* currently we don't count graphic requests submitted from irq contect */
-		if ( (flags & TRACE_FLAG_HARDIRQ) || (flags & TRACE_FLAG_SOFTIRQ)) {
-			consumer = NULL;
-		}
 
 
-		/* if we are X, and someone just woke us, account the GPU op to the guy waking us */
-		if (consumer && strcmp(consumer->name(), "process")==0) {
-			class process *proc = NULL;
-			proc = (class process *) consumer;
-			if (comm_is_xorg(proc->comm) && proc->last_waker) {
-				consumer = proc->last_waker;
-			}
+	/* if we are X, and someone just woke us, account the GPU op to the guy waking us */
+	if (consumer && strcmp(consumer->name(), "process")==0) {
+		class process *proc = NULL;
+		proc = (class process *) consumer;
+		if (comm_is_xorg(proc->comm) && proc->last_waker) {
+			consumer = proc->last_waker;
 		}
+	}
 
 
 
-		if (consumer) {
-			consumer->gpu_ops++;
-		}
+	if (consumer) {
+		consumer->gpu_ops++;
 	}
-	else if (strcmp(event->name, "writeback_inode_dirty") == 0) {
-		static uint64_t prev_time;
-		class power_consumer *consumer = NULL;
-		int dev;
+}
 
-		consumer = current_consumer(cpu);
+enum { WRITEBACK_DEV };
+static const char * const writeback_inode_dirty_fields[] = { "dev", NULL };
 
-		ret = tep_get_field_val(NULL, event, "dev", &rec, &val, 0);
-		if (ret < 0)
+static void handle_writeback_inode_dirty(class trace_decoder *decoder, void *trace, int cpu, uint64_t time)
+{
+	static uint64_t prev_time;
+	class power_consumer *consumer = NULL;
+	int dev;
+
+	track_stamp(time);
 
-			return;
-		dev = (int)val;
+	consumer = current_consumer(cpu);
 
-		if (consumer && strcmp(consumer->name(),
-			"process")==0 && dev > 0) {
+	if (!decoder->has(WRITEBACK_DEV))
+		return;
+	dev = (int)decoder->value(trace, WRITEBACK_DEV);
 
-			consumer->disk_hits++;
+	if (consumer && strcmp(consumer->name(),
+		"process")==0 && dev > 0) {
 
-			/* if the previous inode dirty was > 1 second ago, it becomes a hard hit */
-			if ((time - prev_time) > 1000000000)
-				consumer->hard_disk_hits++;
+		consumer->disk_hits++;
 
-			prev_time = time;
-		}
+		/* if the previous inode dirty was > 1 second ago, it becomes a hard hit */
+		if ((time - prev_time) > 1000000000)
+			consumer->hard_disk_hits++;
+
+		prev_time = time;
 	}
 }
 
+/* runs before the first event of an interval reaches the handlers above */
+static void prepare_process_data(void)
+{
+	clear_processes();
+	clear_interrupts();
+
+	all_power.erase(all_power.begin(), all_power.end());
+
+	/* also empties the consumer stacks */
+	size_cpu_states(get_max_cpu() + 1);
+}
+
+static const struct trace_consumer process_consumer = { "process", prepare_process_data };
+
 #endif /* !_WIN32 */
 
 void start_process_measurement(void)
 {
 #ifndef _WIN32
 	if (!perf_events) {
-		perf_events = new perf_process_bundle();
-		perf_events->add_event("sched","sched_switch");
-		perf_events->add_event("sched","sched_wakeup");
-		perf_events->add_event("irq","irq_handler_entry");
-		perf_events->add_event("irq","irq_handler_exit");
-		perf_events->add_event("irq","softirq_entry");
-		perf_events->add_event("irq","softirq_exit");
-		perf_events->add_event("timer","timer_expire_entry");
-		perf_events->add_event("timer","timer_expire_exit");
-		perf_events->add_event("timer","hrtimer_expire_entry");
-		perf_events->add_event("timer","hrtimer_expire_exit");
-		if (!perf_events->add_event("power","cpu_idle")){
-			perf_events->add_event("power","power_start");
-			perf_events->add_event("power","power_end");
+		perf_events = trace_session_get();
+		perf_events->add_consumer(&process_consumer);
+		perf_events->add_event("sched","sched_switch", handle_sched_switch, sched_switch_fields);
+		perf_events->add_event("sched","sched_wakeup", handle_sched_wakeup, sched_wakeup_fields);
+		perf_events->add_event("irq","irq_handler_entry", handle_irq_handler_entry, irq_handler_entry_fields);
+		perf_events->add_event("irq","irq_handler_exit", handle_irq_exit);
+		perf_events->add_event("irq","softirq_entry", handle_softirq_entry, softirq_entry_fields);
+		perf_events->add_event("irq","softirq_exit", handle_irq_exit);
+		perf_events->add_event("timer","timer_expire_entry", handle_timer_expire_entry, timer_expire_entry_fields);
+		perf_events->add_event("timer","timer_expire_exit", handle_timer_expire_exit, timer_expire_exit_fields);
+		perf_events->add_event("timer","hrtimer_expire_entry", handle_hrtimer_expire_entry, hrtimer_expire_entry_fields);
+		perf_events->add_event("timer","hrtimer_expire_exit", handle_timer_expire_exit, hrtimer_expire_exit_fields);
+		if (!perf_events->add_event("power","cpu_idle", handle_cpu_idle, cpu_idle_fields)){
+			perf_events->add_event("power","power_start", handle_power_start);
+			perf_events->add_event("power","power_end", handle_power_end);
 		}
-		perf_events->add_event("workqueue","workqueue_execute_start");
-		perf_events->add_event("workqueue","workqueue_execute_end");
-		perf_events->add_event("i915","i915_gem_ring_dispatch");
-		perf_events->add_event("i915","i915_gem_request_submit");
-		perf_events->add_event("writeback","writeback_inode_dirty");
+		perf_events->add_event("workqueue","workqueue_execute_start", handle_workqueue_execute_start, workqueue_execute_start_fields);
+		perf_events->add_event("workqueue","workqueue_execute_end", handle_workqueue_execute_end, workqueue_execute_end_fields);
+		perf_events->add_event("i915","i915_gem_ring_dispatch", handle_i915_request, i915_fields);
+		perf_events->add_event("i915","i915_gem_request_submit", handle_i915_request, i915_fields);
+		perf_events->add_event("writeback","writeback_inode_dirty", handle_writeback_inode_dirty, writeback_inode_dirty_fields);
 	}
 
 	first_stamp = ~0ULL;
 	last_stamp = 0;
 	perf_events->start();
 #endif /* !_WIN32 */
+	start_cgroup_measurement();
 }
 
 void end_process_measurement(void)
 {
+	end_cgroup_measurement();
 	if (!perf_events)
 		return;
 #ifndef _WIN32
@@ -704,7 +751,7 @@ void end_process_measurement(void)
 }
 
 
-static bool power_cpu_sort(class power_consumer * i, class power_consumer * j)
+bool power_cpu_sort(class power_consumer * i, class power_consumer * j)
 {
 	double iW, jW;
 
@@ -725,6 +772,25 @@ static bool power_cpu_sort(class power_consumer * i, class power_consumer * j)
         return (iW > jW);
 }
 
+static bool lost_sort(const struct perf_lost &i, const struct perf_lost &j)
+{
+	return i.lost > j.lost;
+}
+
+/* trace records the kernel dropped this interval, worst cpu first */
+static uint64_t lost_samples(vector<struct perf_lost> &list)
+{
+	uint64_t total = 0;
+	unsigned int i;
+
+	perf_lost_samples(list);
+	sort(list.begin(), list.end(), lost_sort);
+
+	for (i = 0; i < list.size(); i++)
+		total += list[i].lost;
+	return total;
+}
+
 double total_wakeups(void)
 {
 	double total = 0;
@@ -795,6 +861,69 @@ double total_xwakes(void)
 	return total;
 }
 
+/* at most this many threads are listed under a process */
+#define THREAD_ROWS	5
+
+/* like power_consumer::usage() and usage_units() */
+static void format_thread_usage(const struct thread_stat *thread, char *buf, size_t len)
+{
+	double t;
+
+	t = thread->runtime / 1000000.0 / measurement_time;
+	if (t < 0.7)
+		snprintf(buf, len, "%5.1f%s", t * 1000, utf_ok ? " µs/s" : " us/s");
+	else if (t < 1000)
+		snprintf(buf, len, "%5.1f ms/s", t);
+	else
+		snprintf(buf, len, "%5i ms/s", (int)t);
+}
+
+static double thread_events(const struct thread_stat *thread)
+{
+	return (thread->wake_ups + thread->gpu_ops + thread->hard_disk_hits) / measurement_time;
+}
+
+static class process *threaded_process(class power_consumer *consumer)
+{
+	class process *proc;
+
+	if (!thread_view || strcmp(consumer->name(), "process"))
+		return NULL;
+	proc = (class process *)consumer;
+	if (proc->nr_threads < 2)
+		return NULL;
+	return proc;
+}
+
+/* the busiest threads of proc, under its line in the Overview */
+static void display_threads(WINDOW *win, class process *proc)
+{
+	unsigned int i;
+
+	for (i = 0; i < proc->nr_threads && i < THREAD_ROWS; i++) {
+		const struct thread_stat *thread = &all_threads[proc->first_thread + i];
+		char usage[20];
+		char events[20];
+
+		if (!thread->runtime && !thread_events(thread))
+			break;
+
+		format_thread_usage(thread, usage, sizeof(usage));
+		align_string(usage, 14, 20);
+		snprintf(events, sizeof(events), "%5.1f", thread_events(thread));
+		if (thread_events(thread) <= 0.3)
+			snprintf(events, sizeof(events), "%5.2f", thread_events(thread));
+		align_string(events, 12, 20);
+
+		wprintw(win, "%10s  %s %s %14s   `- [TID %d] %s\n", "", usage, events, "",
+			thread->tid, thread->comm);
+	}
+	if (i < proc->nr_threads) {
+		wprintw(win, "%10s  %14s %12s %14s   `- ", "", "", "", "");
+		wprintw(win, _("%u more threads\n"), proc->nr_threads - i);
+	}
+}
+
 void process_update_display(void)
 {
 	unsigned int i;
@@ -807,6 +936,8 @@ void process_update_display(void)
 
 	int show_power;
 	int need_linebreak = 0;
+	vector<struct perf_lost> lost;
+	uint64_t lost_total;
 
 	sort(all_power.begin(), all_power.end(), power_cpu_sort);
 
@@ -858,6 +989,15 @@ void process_update_display(void)
 
 	wprintw(win, "%s: %3.1f %s,  %3.1f %s, %3.1f %s %3.1f%% %s\n\n",_("Summary"), total_wakeups(), _("wakeups/second"), total_gpu_ops(), _("GPU ops/seconds"), total_disk_hits(), _("VFS ops/sec and"), total_cpu_time()*100, _("CPU use"));
 
+	lost_total = lost_samples(lost);
+	if (lost_total) {
+		wprintw(win, _("%llu trace events were lost, the numbers below are under-sampled:"),
+			(unsigned long long)lost_total);
+		for (i = 0; i < lost.size() && i < 4; i++)
+			wprintw(win, " cpu%i %llu", lost[i].cpu, (unsigned long long)lost[i].lost);
+		wprintw(win, "\n\n");
+	}
+
 
 	if (show_power)
 		wprintw(win, "%s              %s       %s    %s       %s\n", _("Power est."), _("Usage"), _("Events/s"), _("Category"), _("Description"));
@@ -899,7 +1039,84 @@ void process_update_display(void)
 
 		align_string(events, 12, 20);
 		wprintw(win, "%s  %s %s %s %s\n", power, usage, events, name, pretty_print(all_power[i]->description(), descr, 128));
+
+		if (threaded_process(all_power[i]))
+			display_threads(win, threaded_process(all_power[i]));
+	}
+}
+
+/* the --threads drill-down: the threads of every multi threaded process */
+static void report_threads(void)
+{
+	vector<const struct thread_stat *> threads;
+	vector<class process *> owners;
+	unsigned int i, j;
+	int cols, rows, idx;
+
+	for (i = 0; i < all_power.size() && threads.size() < 100; i++) {
+		class process *proc = threaded_process(all_power[i]);
+
+		if (!proc)
+			continue;
+		for (j = 0; j < proc->nr_threads && threads.size() < 100; j++) {
+			const struct thread_stat *thread = &all_threads[proc->first_thread + j];
+
+			if (!thread->runtime && !thread_events(thread))
+				break;
+			threads.push_back(thread);
+			owners.push_back(proc);
+		}
+	}
+	if (threads.empty())
+		return;
+
+	cols = 6;
+	rows = threads.size() + 1;
+	table_attributes std_table_css;
+	init_nowarp_table_attr(&std_table_css, rows, cols);
+
+	tag_attr title_attr;
+	init_title_attr(&title_attr);
+
+	string *thread_data = new string[cols * rows];
+	thread_data[0] = __("Usage");
+	thread_data[1] = __("Wakeups/s");
+	thread_data[2] = __("Disk IO/s");
+	thread_data[3] = __("TID");
+	thread_data[4] = __("Thread");
+	thread_data[5] = __("Process");
+
+	idx = cols;
+	for (i = 0; i < threads.size(); i++) {
+		char usage[20];
+		char wakes[20];
+		char disks[20];
+		char tid[20];
+		char descr[128];
+
+		format_thread_usage(threads[i], usage, sizeof(usage));
+		snprintf(wakes, sizeof(wakes), "%5.1f", threads[i]->wake_ups / measurement_time);
+		if (threads[i]->wake_ups / measurement_time <= 0.3)
+			snprintf(wakes, sizeof(wakes), "%5.2f", threads[i]->wake_ups / measurement_time);
+		if (threads[i]->wake_ups == 0)
+			wakes[0] = 0;
+		snprintf(disks, sizeof(disks), "%5.1f (%5.1f)", threads[i]->hard_disk_hits / measurement_time,
+				threads[i]->disk_hits / measurement_time);
+		if (threads[i]->disk_hits == 0)
+			disks[0] = 0;
+		snprintf(tid, sizeof(tid), "%d", threads[i]->tid);
+
+		thread_data[idx++] = string(usage);
+		thread_data[idx++] = string(wakes);
+		thread_data[idx++] = string(disks);
+		thread_data[idx++] = string(tid);
+		thread_data[idx++] = string(threads[i]->comm);
+		thread_data[idx++] = string(pretty_print(owners[i]->description(), descr, 128));
 	}
+
+	report.add_title(&title_attr, __("Threads of the Software Power Consumers"));
+	report.add_table(thread_data, &std_table_css);
+	delete [] thread_data;
 }
 
 void report_process_update_display(void)
@@ -1029,10 +1246,52 @@ void report_process_update_display(void)
 	report.add_div(&div_attr);
 	report.add_title(&title_attr, __("Overview of Software Power Consumers"));
 	report.add_table(software_data, &std_table_css);
+	if (thread_view)
+		report_threads();
         report.end_div();
 	delete [] software_data;
 }
 
+void report_lost_samples(void)
+{
+	vector<struct perf_lost> lost;
+	unsigned int i;
+	int rows, cols, idx;
+	char buf[32];
+
+	if (!lost_samples(lost))
+		return;
+
+	tag_attr div_attr;
+	init_div(&div_attr, "clear_block", "lost");
+
+	cols = 2;
+	rows = lost.size() + 1;
+	table_attributes std_table_css;
+	init_std_table_attr(&std_table_css, rows, cols);
+
+	tag_attr title_attr;
+	init_title_attr(&title_attr);
+
+	string *lost_data = new string[cols * rows];
+	lost_data[0] = __("CPU");
+	lost_data[1] = __("Lost records");
+
+	idx = cols;
+	for (i = 0; i < lost.size(); i++) {
+		snprintf(buf, sizeof(buf), "%i", lost[i].cpu);
+		lost_data[idx++] = string(buf);
+		snprintf(buf, sizeof(buf), "%llu", (unsigned long long)lost[i].lost);
+		lost_data[idx++] = string(buf);
+	}
+
+	report.add_div(&div_attr);
+	report.add_title(&title_attr, __("Lost Trace Events"));
+	report.add_table(lost_data, &std_table_css);
+	report.end_div();
+	delete [] lost_data;
+}
+
 void report_summary(void)
 {
 	unsigned int i;
@@ -1162,23 +1421,10 @@ void process_process_data(void)
 	if (!perf_events)
 		return;
 
-	clear_processes();
-	clear_interrupts();
-
-	all_power.erase(all_power.begin(), all_power.end());
-	clear_consumers();
-
-
-	cpu_credit.resize(0, 0);
-	cpu_credit.resize(get_max_cpu()+1, 0);
-	cpu_level.resize(0, 0);
-	cpu_level.resize(get_max_cpu()+1, 0);
-	cpu_blame.resize(0, NULL);
-	cpu_blame.resize(get_max_cpu()+1, NULL);
-
-
-
-	/* process data */
+	/*
+	 * process data; the session is shared with the cpu code, whichever
+	 * of us comes first runs prepare_process_data() and our handlers
+	 */
 #ifndef _WIN32
 	perf_events->process();
 	perf_events->clear();
@@ -1187,6 +1433,7 @@ void process_process_data(void)
 	run_devpower_list();
 
 	merge_processes();
+	snapshot_consumer_costs();
 
 	all_processes_to_all_power();
 	all_interrupts_to_all_power();
@@ -1224,6 +1471,9 @@ void end_process_data(void)
 	report_utilization("disk-operations-hard", total_hard_disk_hits());
 	report_utilization("xwakes", total_xwakes());
 
+	if (debug_learning)
+		consumer_pools_debug();
+
 	all_power.erase(all_power.begin(), all_power.end());
 	clear_processes();
 	clear_proc_devices();
@@ -1231,6 +1481,7 @@ void end_process_data(void)
 	clear_timers();
 	clear_work();
 	clear_consumers();
+	clear_cgroups();
 
 #ifndef _WIN32
 	perf_events->clear();
@@ -1242,8 +1493,14 @@ void clear_process_data(void)
 {
 #ifndef _WIN32
 	if (perf_events)
-		perf_events->release();
-	delete perf_events;
+		trace_session_put();
+	perf_events = NULL;
 #endif
+	pid_cache_stop();
+
+	delete [] cpu_state_mem;
+	cpu_state_mem = NULL;
+	cpu_states = &boot_cpu_state;
+	nr_cpu_states = 0;
 }
 
@@ -56,6 +56,7 @@ interrupt::interrupt(const char *_handler, int _number) : power_consumer()
 
 
 vector <class interrupt *> all_interrupts;
+static consumer_pool<class interrupt> interrupt_pool("interrupt");
 
 void interrupt::start_interrupt(uint64_t time)
 {
@@ -92,25 +93,74 @@ const char * interrupt::usage_units_summary(void)
 }
 
 
-class interrupt * find_create_interrupt(const char *_handler, int nr, int cpu)
+/*
+ * Direct mapped cache in front of all_interrupts, keyed by irq number and,
+ * for the per cpu "timer" interrupt, the cpu. A hit costs one compare of
+ * the handler name (shared irq lines have several); anything else falls
+ * back to the scan and takes over the slot.
+ */
+#define IRQ_TABLE_SIZE 1024
+
+struct irq_slot {
+	int nr;
+	int cpu;		/* -1 unless this is a timer/N */
+	class interrupt *irq;
+};
+
+static struct irq_slot irq_table[IRQ_TABLE_SIZE];
+static vector<string> timer_names;
+
+static const char *timer_name(int cpu)
 {
-	char handler[64];
-	unsigned int i;
-	class interrupt *new_irq;
+	char name[32];
 
-	pt_strcpy(handler, _handler);
-	if (strcmp(handler, "timer")==0)
-		sprintf(handler, "timer/%i", cpu);
+	/* "timer/N" for every cpu, made once */
+	while (timer_names.size() <= (unsigned int)cpu) {
+		snprintf(name, sizeof(name), "timer/%i", (int)timer_names.size());
+		timer_names.push_back(name);
+	}
+	return timer_names[cpu].c_str();
+}
+
+static inline bool same_handler(const char *handler, class interrupt *irq)
+{
+	return strncmp(handler, irq->handler, sizeof(irq->handler) - 1) == 0;
+}
+
+class interrupt * find_create_interrupt(const char *handler, int nr, int cpu)
+{
+	unsigned int i;
+	int key_cpu = -1;
+	struct irq_slot *slot;
+	class interrupt *irq = NULL;
+
+	if (strcmp(handler, "timer") == 0) {
+		if (cpu < 0)
+			cpu = 0;
+		handler = timer_name(cpu);
+		key_cpu = cpu;
+	}
 
+	slot = &irq_table[((unsigned int)nr * 2654435761u + (unsigned int)(key_cpu + 1)) % IRQ_TABLE_SIZE];
+	if (slot->irq && slot->nr == nr && slot->cpu == key_cpu && same_handler(handler, slot->irq))
+		return slot->irq;
 
 	for (i = 0; i < all_interrupts.size(); i++) {
-		if (all_interrupts[i] && all_interrupts[i]->number == nr && strcmp(handler, all_interrupts[i]->handler) == 0)
-			return all_interrupts[i];
+		if (all_interrupts[i] && all_interrupts[i]->number == nr && same_handler(handler, all_interrupts[i])) {
+			irq = all_interrupts[i];
+			break;
+		}
 	}
 
-	new_irq = new class interrupt(handler, nr);
-	all_interrupts.push_back(new_irq);
-	return new_irq;
+	if (!irq) {
+		irq = new (interrupt_pool.get()) class interrupt(handler, nr);
+		all_interrupts.push_back(irq);
+	}
+
+	slot->nr = nr;
+	slot->cpu = key_cpu;
+	slot->irq = irq;
+	return irq;
 }
 
 void all_interrupts_to_all_power(void)
@@ -123,9 +173,10 @@ void all_interrupts_to_all_power(void)
 
 void clear_interrupts(void)
 {
-	std::vector<class interrupt *>::iterator it = all_interrupts.begin();
-	while (it != all_interrupts.end()) {
-		delete *it;
-		it = all_interrupts.erase(it);
-	}
+	unsigned int i;
+
+	for (i = 0; i < all_interrupts.size(); i++)
+		interrupt_pool.put(all_interrupts[i]);
+	all_interrupts.clear();
+	memset(irq_table, 0, sizeof(irq_table));
 }
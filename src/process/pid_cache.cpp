@@ -0,0 +1,287 @@
+/*
+ * Copyright 2010, Intel Corporation
+ *
+ * This file is part of PowerTOP
+ *
+ * This program file is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; version 2 of the License.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program in a file named COPYING; if not, write to the
+ * Free Software Foundation, Inc,
+ * 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1301 USA
+ * or just google for it.
+ *
+ * Authors:
+ *	Arjan van de Ven <arjan@linux.intel.com>
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <iostream>
+#include <fstream>
+#include <iterator>
+#include <algorithm>
+#include <vector>
+#include <unordered_map>
+
+#include "pid_cache.h"
+#include "../platform/platform.h"
+#include "../perf/perf_capture.h"
+#include "../lib.h"
+
+#ifndef _WIN32
+/* entries nobody asked for in this many syncs are dropped */
+#define PID_CACHE_MAX_AGE	8
+
+static unordered_map<int, struct pid_info> pid_cache;
+static unsigned int generation;
+
+static pthread_mutex_t pid_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t pid_work = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t pid_done = PTHREAD_COND_INITIALIZER;
+
+static vector<int> pid_queue;
+static bool pid_busy;
+static bool pid_stop;
+static bool worker_running;
+static pt_thread_t worker;
+
+/*
+ * Field 22 of /proc/<pid>/stat, 0 if the pid is gone, and the comm
+ * (field 2) that goes with it.
+ */
+static uint64_t read_start_time(int pid, string &comm)
+{
+	char filename[64];
+	char line[1024];
+	unsigned long long start = 0;
+	char *c, *paren;
+	int field;
+	FILE *file;
+
+	comm.clear();
+	snprintf(filename, sizeof(filename), "/proc/%i/stat", pid);
+	file = fopen(filename, "r");
+	if (!file)
+		return 0;
+	if (!fgets(line, sizeof(line), file)) {
+		fclose(file);
+		return 0;
+	}
+	fclose(file);
+
+	/* the comm can contain anything, count fields from its closing ')' */
+	paren = strchr(line, '(');
+	c = strrchr(line, ')');
+	if (!paren || !c || c < paren)
+		return 0;
+	comm.assign(paren + 1, c - paren - 1);
+	c++;
+	for (field = 2; field < 21 && c; field++)
+		c = strchr(c + 1, ' ');
+	if (c)
+		start = strtoull(c + 1, NULL, 10);
+	return start;
+}
+
+static void read_pid_info(int pid, struct pid_info *info)
+{
+	char line[4097];
+	ifstream file;
+
+	info->tgid = 0;
+	info->has_cmdline = false;
+	info->cmdline.clear();
+	info->cgroup.clear();
+	info->captured = false;
+
+	/* the /proc of this machine knows nothing about the captured one */
+	if (replay_active()) {
+		replay_pid_info(pid, &info->tgid, &info->has_cmdline, info->cmdline, info->cgroup);
+		return;
+	}
+
+	sprintf(line, "/proc/%i/status", pid);
+	file.open(line);
+	while (file) {
+		file.getline(line, 4096);
+		line[4096] = '\0';
+		if (strstr(line, "Tgid")) {
+			char *c;
+			c = strchr(line, ':');
+			if (!c)
+				continue;
+			c++;
+			info->tgid = strtoull(c, NULL, 10);
+			break;
+		}
+	}
+	file.close();
+
+	sprintf(line, "/proc/%i/cmdline", pid);
+	file.open(line, ios::binary);
+	if (file) {
+		std::string cmdline(std::istreambuf_iterator<char>(file), (std::istreambuf_iterator<char>()));
+		file.close();
+		std::replace(cmdline.begin(), cmdline.end(), '\0', ' ');
+		info->has_cmdline = true;
+		info->cmdline = cmdline;
+	}
+
+	/* the unified hierarchy is the "0::" line; v1 only systems have none */
+	sprintf(line, "/proc/%i/cgroup", pid);
+	file.open(line);
+	while (file) {
+		file.getline(line, 4096);
+		line[4096] = '\0';
+		if (strncmp(line, "0::", 3) == 0) {
+			info->cgroup = line + 3;
+			break;
+		}
+	}
+	file.close();
+}
+
+/*
+ * Runs on the worker only, and the main thread only reads the cache once
+ * the worker is idle (pid_cache_sync()), so the cache itself needs no
+ * lock.
+ */
+static void resolve_pid(int pid)
+{
+	struct pid_info *info;
+	uint64_t start = 0;
+	string comm;
+	bool known;
+
+	/* no start time to go by, the capture says what pid was each interval */
+	if (!replay_active())
+		start = read_start_time(pid, comm);
+	known = pid_cache.count(pid) > 0;
+	info = &pid_cache[pid];
+	info->last_used = generation;
+
+	/* an execve() keeps the pid and start time, but not the comm */
+	if (known && start && info->start_time == start && info->comm == comm)
+		return;
+
+	info->start_time = start;
+	info->comm = comm;
+	read_pid_info(pid, info);
+}
+
+static void *pid_cache_worker(void *arg)
+{
+	vector<int> batch;
+	unsigned int i;
+
+	pthread_mutex_lock(&pid_lock);
+	while (!pid_stop) {
+		if (pid_queue.empty()) {
+			pthread_cond_wait(&pid_work, &pid_lock);
+			continue;
+		}
+		batch.swap(pid_queue);
+		pid_busy = true;
+		pthread_mutex_unlock(&pid_lock);
+
+		for (i = 0; i < batch.size(); i++)
+			resolve_pid(batch[i]);
+		batch.clear();
+
+		pthread_mutex_lock(&pid_lock);
+		pid_busy = false;
+		if (pid_queue.empty())
+			pthread_cond_broadcast(&pid_done);
+	}
+	pthread_mutex_unlock(&pid_lock);
+	return NULL;
+}
+
+void pid_cache_request(int pid)
+{
+	pthread_mutex_lock(&pid_lock);
+	if (!worker_running && !pid_stop)
+		worker_running = pt_thread_create(&worker, pid_cache_worker, NULL) == 0;
+	pid_queue.push_back(pid);
+	pthread_cond_signal(&pid_work);
+	pthread_mutex_unlock(&pid_lock);
+}
+
+void pid_cache_sync(void)
+{
+	unordered_map<int, struct pid_info>::iterator it;
+	vector<int> left;
+	unsigned int i;
+
+	pthread_mutex_lock(&pid_lock);
+	if (worker_running) {
+		while (!pid_queue.empty() || pid_busy)
+			pthread_cond_wait(&pid_done, &pid_lock);
+	} else
+		left.swap(pid_queue);
+	pthread_mutex_unlock(&pid_lock);
+
+	/* no worker (could not be started): do it here after all */
+	for (i = 0; i < left.size(); i++)
+		resolve_pid(left[i]);
+
+	/* what was read this interval goes into the capture, for a replay */
+	if (capture_active()) {
+		for (it = pid_cache.begin(); it != pid_cache.end(); ++it) {
+			if (it->second.captured || it->second.last_used != generation)
+				continue;
+			capture_pid_info(it->first, it->second.tgid, it->second.has_cmdline,
+					 it->second.cmdline, it->second.cgroup);
+			it->second.captured = true;
+		}
+	}
+
+	generation++;
+	for (it = pid_cache.begin(); it != pid_cache.end(); ) {
+		if (generation - it->second.last_used > PID_CACHE_MAX_AGE)
+			it = pid_cache.erase(it);
+		else
+			++it;
+	}
+}
+
+const struct pid_info *pid_cache_lookup(int pid)
+{
+	unordered_map<int, struct pid_info>::iterator it;
+
+	it = pid_cache.find(pid);
+	if (it == pid_cache.end())
+		return NULL;
+	return &it->second;
+}
+
+void pid_cache_stop(void)
+{
+	pthread_mutex_lock(&pid_lock);
+	pid_stop = true;
+	pthread_cond_signal(&pid_work);
+	pthread_mutex_unlock(&pid_lock);
+
+	if (worker_running)
+		pt_thread_join(worker);
+	worker_running = false;
+	pid_queue.clear();
+	pid_cache.clear();
+}
+#else /* _WIN32 */
+/* there is no /proc to read on Windows */
+void pid_cache_request(int) {}
+void pid_cache_sync(void) {}
+const struct pid_info *pid_cache_lookup(int) { return NULL; }
+void pid_cache_stop(void) {}
+#endif /* !_WIN32 */
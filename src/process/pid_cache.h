@@ -0,0 +1,61 @@
+/*
+ * Copyright 2010, Intel Corporation
+ *
+ * This file is part of PowerTOP
+ *
+ * This program file is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; version 2 of the License.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program in a file named COPYING; if not, write to the
+ * Free Software Foundation, Inc,
+ * 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1301 USA
+ * or just google for it.
+ *
+ * Authors:
+ *	Arjan van de Ven <arjan@linux.intel.com>
+ */
+#ifndef _INCLUDE_GUARD_PID_CACHE_H
+#define _INCLUDE_GUARD_PID_CACHE_H
+
+#include <stdint.h>
+#include <string>
+
+using namespace std;
+
+/*
+ * What process::process() used to read from /proc/<pid>/status and
+ * /proc/<pid>/cmdline itself, plus the cgroup from /proc/<pid>/cgroup.
+ * Entries are kept across measurement intervals and only re-read when
+ * /proc/<pid>/stat has a different start time (the pid now belongs to a
+ * different task) or comm (the task called execve()). A replay takes them
+ * from the capture file instead.
+ */
+struct pid_info {
+	uint64_t	start_time;
+	string		comm;		/* from /proc/<pid>/stat along with start_time */
+	int		tgid;		/* 0 if not known */
+	bool		has_cmdline;	/* false if the task was already gone */
+	string		cmdline;	/* NULs turned into spaces, empty for kernel threads */
+	string		cgroup;		/* cgroup v2 path, empty if not known */
+	unsigned int	last_used;
+	bool		captured;	/* written to the --record file since it was read */
+};
+
+/* queue pid for the background worker; never touches /proc itself */
+extern void pid_cache_request(int pid);
+
+/* wait for the worker to finish the queue, then look up */
+extern void pid_cache_sync(void);
+extern const struct pid_info *pid_cache_lookup(int pid);
+
+extern void pid_cache_stop(void);
+
+#endif
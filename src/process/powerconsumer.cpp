@@ -23,38 +23,70 @@
  *	Arjan van de Ven <arjan@linux.intel.com>
  */
 
+#include <stdio.h>
+
 #include "powerconsumer.h"
 #include "process.h"
 #include "../parameters/parameters.h"
 
+/*
+ * What Witts() charges for each kind of activity. The learner only moves
+ * the parameters between measurement intervals, so they are copied out of
+ * all_parameters once per interval instead of being looked up by name for
+ * every consumer in every sort comparison.
+ */
+struct consumer_costs {
+	bool	valid;
+	double	time;
+	double	wakeup;
+	double	gpu;
+	double	disk;
+	double	hard_disk;
+	double	xwake;
+};
+
+static struct consumer_costs costs;
+static int time_index, wakeup_index, gpu_index, disk_index, hard_disk_index, xwake_index;
+
+void resolve_consumer_costs(void)
+{
+	time_index = get_param_index("cpu-consumption");
+	wakeup_index = get_param_index("cpu-wakeups");
+	gpu_index = get_param_index("gpu-operations");
+	disk_index = get_param_index("disk-operations");
+	hard_disk_index = get_param_index("disk-operations-hard");
+	xwake_index = get_param_index("xwakes");
+}
+
+void snapshot_consumer_costs(void)
+{
+	costs.time = get_parameter_value(time_index);
+	costs.wakeup = get_parameter_value(wakeup_index);
+	costs.gpu = get_parameter_value(gpu_index);
+	costs.disk = get_parameter_value(disk_index);
+	costs.hard_disk = get_parameter_value(hard_disk_index);
+	costs.xwake = get_parameter_value(xwake_index);
+	costs.valid = true;
+}
+
 double power_consumer::Witts(void)
 {
 	double cost;
-	double timecost;
-	double wakeupcost;
-	double gpucost;
-	double disk_cost;
-	double hard_disk_cost;
-	double xwake_cost;
 
 	if (child_runtime > accumulated_runtime)
 		child_runtime = 0;
 
-	timecost = get_parameter_value("cpu-consumption");
-	wakeupcost = get_parameter_value("cpu-wakeups");
-	gpucost = get_parameter_value("gpu-operations");
-	disk_cost = get_parameter_value("disk-operations");
-	hard_disk_cost = get_parameter_value("disk-operations-hard");
-	xwake_cost = get_parameter_value("xwakes");
+	if (!costs.valid)
+		snapshot_consumer_costs();
 
 	cost = 0;
 
-	cost += wakeupcost * wake_ups / 10000.0;
-	cost += ( (accumulated_runtime - child_runtime) / 1000000000.0) * timecost;
-	cost += gpucost * gpu_ops / 100.0;
-	cost += hard_disk_cost * hard_disk_hits / 100.0;
-	cost += disk_cost * disk_hits / 100.0;
-	cost += xwake_cost * xwakes / 100.0;
+	cost += costs.wakeup * wake_ups / 10000.0;
+	cost += ( (accumulated_runtime - child_runtime) / 1000000000.0) * costs.time;
+	cost += costs.gpu * gpu_ops / 100.0;
+	cost += costs.hard_disk * hard_disk_hits / 100.0;
+	cost += costs.disk * disk_hits / 100.0;
+	cost += costs.xwake * xwakes / 100.0;
 
 	cost = cost / measurement_time;
 
@@ -98,3 +130,24 @@ const char * power_consumer::usage_units(void)
 	}
 	return " ms/s";
 }
+
+/* constant initialized, so safe to link into from other static constructors */
+static class consumer_pool_base *consumer_pools = NULL;
+
+consumer_pool_base::consumer_pool_base(const char *_name)
+{
+	name = _name;
+	live = 0;
+	peak = 0;
+	next = consumer_pools;
+	consumer_pools = this;
+}
+
+void consumer_pools_debug(void)
+{
+	class consumer_pool_base *pool;
+
+	for (pool = consumer_pools; pool; pool = pool->next)
+		fprintf(stderr, "consumer pool %-10s: %u in use, %u allocated, high water %u\n",
+			pool->name, pool->in_use(), pool->allocated(), pool->high_water());
+}
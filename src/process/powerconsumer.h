@@ -28,6 +28,7 @@
 #include <stdint.h>
 #include <vector>
 #include <algorithm>
+#include <new>
 
 using namespace std;
 
@@ -70,6 +71,68 @@ public:
 
 extern vector <class power_consumer *> all_power;
 
+/* look up the parameters Witts() uses, once they are registered */
+extern void resolve_consumer_costs(void);
+/* take their values for this interval */
+extern void snapshot_consumer_costs(void);
+
+/* the order of all_power in the reports, most expensive first */
+extern bool power_cpu_sort(class power_consumer * i, class power_consumer * j);
+
+/*
+ * The consumers are thrown away at the end of every interval and mostly
+ * the same ones come back in the next; instead of going back to the heap
+ * their memory is kept here and the next object is constructed in place:
+ *
+ *	proc = new (process_pool.get()) class process(comm, pid);
+ *	...
+ *	process_pool.put(proc);
+ *
+ * All pools link themselves into one list for consumer_pools_debug().
+ */
+class consumer_pool_base {
+protected:
+	vector<void *>	spare;
+	unsigned int	live;
+	unsigned int	peak;
+public:
+	const char	*name;
+	class consumer_pool_base *next;
+
+	consumer_pool_base(const char *_name);
+
+	unsigned int in_use(void) { return live; };
+	unsigned int high_water(void) { return peak; };
+	unsigned int allocated(void) { return live + spare.size(); };
+};
+
+template <class T> class consumer_pool : public consumer_pool_base {
+public:
+	consumer_pool(const char *_name) : consumer_pool_base(_name) {};
+
+	void *get(void)
+	{
+		void *mem;
+
+		if (++live > peak)
+			peak = live;
+		if (spare.empty())
+			return ::operator new(sizeof(T));
+		mem = spare.back();
+		spare.pop_back();
+		return mem;
+	};
+
+	void put(T *obj)
+	{
+		obj->~T();
+		spare.push_back(obj);
+		live--;
+	};
+};
+
+extern void consumer_pools_debug(void);
+
 extern double total_wakeups(void);
 extern double total_cpu_time(void);
 extern double total_gpu_ops(void);
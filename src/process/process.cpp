@@ -35,11 +35,18 @@
 #include <fstream>
 #include <algorithm>
 #include <iterator>
+#include <unordered_map>
 #include "../lib.h"
+#include "pid_cache.h"
+#include "cgroup.h"
 
 
 vector <class process *> all_processes;
 
+int thread_view = 0;
+vector<struct thread_stat> all_threads;
+static consumer_pool<class process> process_pool("process");
+
 void process::account_disk_dirty(void)
 {
 	disk_hits++;
@@ -73,16 +80,8 @@ uint64_t process::deschedule_thread(uint64_t time, int thread_id)
 	return delta;
 }
 
-static void cmdline_to_string(std::string& str)
-{
-	std::replace(str.begin(), str.end(), '\0', ' ');
-}
-
-
 process::process(const char *_comm, int _pid, int _tid) : power_consumer()
 {
-	char line[4097];
-	ifstream file;
 	ssize_t pos;
 
 	pt_strcpy(comm, _comm);
@@ -93,25 +92,9 @@ process::process(const char *_comm, int _pid, int _tid) : power_consumer()
 	waker = NULL;
 	is_kernel = 0;
 	tgid = _tid;
-
-	if (_tid == 0) {
-		sprintf(line, "/proc/%i/status", _pid);
-		file.open(line);
-		while (file) {
-			file.getline(line, 4096);
-			line[4096] = '\0';
-			if (strstr(line, "Tgid")) {
-				char *c;
-				c = strchr(line, ':');
-				if (!c)
-					continue;
-				c++;
-				tgid = strtoull(c, NULL, 10);
-				break;
-			}
-		}
-		file.close();
-	}
+	first_thread = 0;
+	nr_threads = 0;
+	cgroup = -1;
 
 	if (strncmp(_comm, "kondemand/", 10) == 0)
 		is_idle = 1;
@@ -126,19 +109,38 @@ process::process(const char *_comm, int _pid, int _tid) : power_consumer()
 	strncpy(desc + pos, comm, sizeof(desc) - pos - 1);
 	desc[sizeof(desc) - 1] = '\0';
 
-	sprintf(line, "/proc/%i/cmdline", _pid);
-	file.open(line, ios::binary);
-	if (file) {
-		std::string cmdline(std::istreambuf_iterator<char>(file), (std::istreambuf_iterator<char>()));
-		file.close();
-		if (cmdline.size() < 1) {
-			is_kernel = 1;
-			snprintf(desc + pos, sizeof(desc) - pos, "[%s]", comm);
-		} else {
-			cmdline_to_string(cmdline);
-			strncpy(desc + pos, cmdline.c_str(), sizeof(desc) - pos - 1);
-			desc[sizeof(desc) - 1] = '\0';
-		}
+	/*
+	 * tgid and command line come from /proc; that is read by the pid
+	 * cache worker, not here in the middle of trace processing, and
+	 * filled in by resolve_processes().
+	 */
+	pid_cache_request(pid);
+}
+
+/* what the constructor used to read from /proc itself */
+void process::apply_pid_info(const struct pid_info *info)
+{
+	ssize_t pos;
+
+	if (tgid == 0)
+		tgid = info->tgid;
+	cgroup = cgroup_id(info->cgroup);
+
+	if (!info->has_cmdline)
+		return;
+
+	pos = snprintf(desc, sizeof(desc), "[PID %d] ", pid);
+	if (pos < 0)
+		pos = 0;
+	if ((size_t)pos > sizeof(desc))
+		return;
+
+	if (info->cmdline.size() < 1) {
+		is_kernel = 1;
+		snprintf(desc + pos, sizeof(desc) - pos, "[%s]", comm);
+	} else {
+		strncpy(desc + pos, info->cmdline.c_str(), sizeof(desc) - pos - 1);
+		desc[sizeof(desc) - 1] = '\0';
 	}
 }
 
@@ -163,18 +165,75 @@ const char * process::usage_units_summary(void)
 	return "%";
 }
 
-class process * find_create_process(const char *comm, int pid)
+/*
+ * Open addressing index over all_processes, keyed on (pid, comm), so that
+ * the sched_switch and sched_wakeup handlers do not scan every process
+ * for every event. Linear probing, kept at most half full. Entries only
+ * go away all at once (clear_processes(), merge_processes()), so there
+ * are no tombstones; the index is simply rebuilt.
+ */
+static vector<class process *> process_index;
+static unsigned int process_index_used;
+
+static unsigned int process_hash(const char *comm, int pid)
 {
+	unsigned int hash = 2166136261u ^ (unsigned int)pid;
 	unsigned int i;
-	class process *new_proc;
 
-	for (i = 0; i < all_processes.size(); i++) {
-		if (all_processes[i]->pid == pid && strcmp(comm, all_processes[i]->comm) == 0)
-			return all_processes[i];
+	/* FNV-1a over the comm, as far as process::comm keeps it */
+	for (i = 0; i < sizeof(((class process *)0)->comm) - 1 && comm[i]; i++) {
+		hash ^= (unsigned char)comm[i];
+		hash *= 16777619u;
 	}
+	return hash;
+}
+
+static void process_index_add(class process *proc)
+{
+	unsigned int mask = process_index.size() - 1;
+	unsigned int slot;
+
+	slot = process_hash(proc->comm, proc->pid) & mask;
+	while (process_index[slot])
+		slot = (slot + 1) & mask;
+	process_index[slot] = proc;
+	process_index_used++;
+}
+
+static void rebuild_process_index(unsigned int size)
+{
+	unsigned int i;
 
-	new_proc = new class process(comm, pid);
+	process_index.assign(size, NULL);
+	process_index_used = 0;
+	for (i = 0; i < all_processes.size(); i++)
+		process_index_add(all_processes[i]);
+}
+
+class process * find_create_process(const char *comm, int pid)
+{
+	class process *new_proc;
+	unsigned int mask, slot, size;
+
+	if (!process_index.empty()) {
+		mask = process_index.size() - 1;
+		slot = process_hash(comm, pid) & mask;
+		while (process_index[slot]) {
+			if (process_index[slot]->pid == pid && strncmp(comm, process_index[slot]->comm,
+					sizeof(process_index[slot]->comm) - 1) == 0)
+				return process_index[slot];
+			slot = (slot + 1) & mask;
+		}
+	}
+
+	new_proc = new (process_pool.get()) class process(comm, pid);
 	all_processes.push_back(new_proc);
+
+	if ((process_index_used + 1) * 2 > process_index.size()) {
+		size = process_index.empty() ? 1024 : process_index.size() * 2;
+		rebuild_process_index(size);
+	} else
+		process_index_add(new_proc);
 	return new_proc;
 }
 
@@ -196,35 +255,140 @@ static void merge_process(class process *one, class process *two)
 }
 
 
+/* wait for the pid cache and give every process its /proc metadata */
+void resolve_processes(void)
+{
+	const struct pid_info *info;
+	unsigned int i;
+
+	pid_cache_sync();
+	for (i = 0; i < all_processes.size(); i++) {
+		info = pid_cache_lookup(all_processes[i]->pid);
+		if (info)
+			all_processes[i]->apply_pid_info(info);
+	}
+}
+
+static void snapshot_thread(class process *proc, struct thread_stat *thread)
+{
+	thread->runtime = 0;
+	if (proc->accumulated_runtime > proc->child_runtime)
+		thread->runtime = proc->accumulated_runtime - proc->child_runtime;
+	thread->tid = proc->pid;
+	thread->owner = 0;
+	thread->wake_ups = proc->wake_ups;
+	thread->gpu_ops = proc->gpu_ops;
+	thread->disk_hits = proc->disk_hits;
+	thread->hard_disk_hits = proc->hard_disk_hits;
+	thread->xwakes = proc->xwakes;
+	memcpy(thread->comm, proc->comm, sizeof(thread->comm));
+}
+
+static bool thread_sort(const struct thread_stat &i, const struct thread_stat &j)
+{
+	if (i.owner != j.owner)
+		return i.owner < j.owner;
+	if (i.runtime != j.runtime)
+		return i.runtime > j.runtime;
+	return i.wake_ups > j.wake_ups;
+}
+
+/*
+ * Group the snapshots by the process they were folded into, busiest
+ * first, and drop the ones of processes that only had the one thread.
+ */
+static void group_threads(void)
+{
+	unsigned int i, j, kept = 0;
+
+	sort(all_threads.begin(), all_threads.end(), thread_sort);
+
+	for (i = 0; i < all_threads.size(); i = j) {
+		class process *proc = all_processes[all_threads[i].owner];
+
+		for (j = i + 1; j < all_threads.size() && all_threads[j].owner == all_threads[i].owner; j++)
+			;
+		if (j - i < 2)
+			continue;
+
+		proc->first_thread = kept;
+		proc->nr_threads = j - i;
+		if (kept != i)
+			copy(all_threads.begin() + i, all_threads.begin() + j, all_threads.begin() + kept);
+		kept += j - i;
+	}
+	all_threads.resize(kept);
+}
+
+/*
+ * Fold threads into their process (pid == tgid) and add up entries with
+ * the same description. Each entry goes into the earliest surviving entry
+ * it matches, in list order; both kinds of match are looked up by hash
+ * and the list is compacted once at the end.
+ */
 void merge_processes(void)
 {
-	std::vector<class process*>::iterator it1, it2;
-	class process *one, *two;
-
-	it1 = all_processes.begin();
-	while (it1 != all_processes.end()) {
-		it2 = it1 + 1;
-		one = *it1;
-		while (it2 != all_processes.end()) {
-			two = *it2;
-			/* fold threads */
-			if (one->pid == two->tgid && two->tgid != 0) {
-				merge_process(one, two);
-				delete *it2;
-				it2 = all_processes.erase(it2);
-				continue;
-			}
-			/* find dupes and add up */
-			if (!strcmp(one->desc, two->desc)) {
-				merge_process(one, two);
-				delete *it2;
-				it2 = all_processes.erase(it2);
-				continue;
-			}
-			++it2;
+	unordered_map<int, unsigned int> by_pid;
+	unordered_map<string, unsigned int> by_desc;
+	unordered_map<int, unsigned int>::iterator pid_it;
+	unordered_map<string, unsigned int>::iterator desc_it;
+	unsigned int i, kept = 0;
+
+	/* both tgid and desc come from /proc */
+	resolve_processes();
+
+	/* while every task is still on its own */
+	account_cgroups();
+
+	by_pid.reserve(all_processes.size());
+	by_desc.reserve(all_processes.size());
+
+	/* before anything is folded: what each thread did on its own */
+	all_threads.clear();
+	if (thread_view) {
+		all_threads.resize(all_processes.size());
+		for (i = 0; i < all_processes.size(); i++)
+			snapshot_thread(all_processes[i], &all_threads[i]);
+	}
+
+	for (i = 0; i < all_processes.size(); i++) {
+		class process *two = all_processes[i];
+		unsigned int into = kept;
+
+		/* fold threads */
+		if (two->tgid != 0) {
+			pid_it = by_pid.find(two->tgid);
+			if (pid_it != by_pid.end())
+				into = pid_it->second;
+		}
+		/* find dupes and add up */
+		desc_it = by_desc.find(two->desc);
+		if (desc_it != by_desc.end() && desc_it->second < into)
+			into = desc_it->second;
+
+		if (thread_view)
+			all_threads[i].owner = into;
+
+		if (into < kept) {
+			merge_process(all_processes[into], two);
+			process_pool.put(two);
+			continue;
 		}
-		++it1;
+
+		/* survivors keep their order; the first one with a pid wins */
+		all_processes[kept] = two;
+		by_pid.insert(make_pair(two->pid, kept));
+		by_desc.insert(make_pair(string(two->desc), kept));
+		kept++;
 	}
+	all_processes.resize(kept);
+
+	if (thread_view)
+		group_threads();
+
+	/* merged processes are gone, and the survivors are still looked up */
+	if (!process_index.empty())
+		rebuild_process_index(process_index.size());
 }
 
 void all_processes_to_all_power(void)
@@ -238,9 +402,15 @@ void all_processes_to_all_power(void)
 
 void clear_processes(void)
 {
-	std::vector <class process *>::iterator it = all_processes.begin();
-	while (it != all_processes.end()) {
-		delete *it;
-		it = all_processes.erase(it);
-	}
+	unsigned int i;
+
+	for (i = 0; i < all_processes.size(); i++)
+		process_pool.put(all_processes[i]);
+	all_processes.clear();
+	all_threads.clear();
+
+	/* keep the table size, the next interval sees about as many */
+	if (!process_index.empty())
+		process_index.assign(process_index.size(), NULL);
+	process_index_used = 0;
 }
@@ -29,6 +29,8 @@
 
 #include "powerconsumer.h"
 
+struct pid_info;
+
 #ifdef __x86_64__
 #define BIT64 1
 #endif
@@ -51,9 +53,16 @@ public:
 	int		is_idle;   /* count this as if the cpu was idle */
 	int		running;
 	int		is_kernel; /* kernel thread */
+	int		cgroup;    /* cgroup_id(), -1 if not known */
+
+	/* with thread_view, the threads folded into us are all_threads[first_thread ...] */
+	unsigned int	first_thread;
+	unsigned int	nr_threads;
 
 	process(const char *_comm, int _pid, int _tid = 0);
 
+	void apply_pid_info(const struct pid_info *info);
+
 	virtual void schedule_thread(uint64_t time, int thread_id);
 	virtual uint64_t deschedule_thread(uint64_t time, int thread_id = 0);
 
@@ -70,6 +79,26 @@ public:
 
 extern vector <class process *> all_processes;
 
+/*
+ * What one thread did in the interval, kept (with --threads) when
+ * merge_processes() folds it into its process. Much smaller than the
+ * process object it is taken from.
+ */
+struct thread_stat {
+	uint64_t	runtime;	/* without the time of interrupts etc on top */
+	int		tid;
+	unsigned int	owner;		/* index of the process in all_processes */
+	int		wake_ups;
+	int		gpu_ops;
+	int		disk_hits;
+	int		hard_disk_hits;
+	int		xwakes;
+	char		comm[16];
+};
+
+extern int thread_view;
+extern vector<struct thread_stat> all_threads;
+
 extern double measurement_time;
 
 
@@ -79,6 +108,7 @@ extern void process_process_data(void);
 extern void end_process_data(void);
 extern void clear_process_data(void);
 extern void merge_processes(void);
+extern void resolve_processes(void);
 
 extern class process * find_create_process(const char *comm, int pid);
 extern class process * find_create_process(char *comm, int pid);
@@ -88,6 +118,7 @@ extern void clear_processes(void);
 extern void process_update_display(void);
 extern void report_process_update_display(void);
 extern void report_summary(void);
+extern void report_lost_samples(void);
 
 
 
@@ -27,6 +27,7 @@
 #include <stdio.h>
 
 vector<class device_consumer *> all_proc_devices;
+static consumer_pool<class device_consumer> device_pool("device");
 
 
 device_consumer::device_consumer(class device *dev) : power_consumer()
@@ -77,7 +78,7 @@ static void add_device(class device *device)
 		}
 	}
 
-	dev = new class device_consumer(device);
+	dev = new (device_pool.get()) class device_consumer(device);
 	all_power.push_back(dev);
 	all_proc_devices.push_back(dev);
 }
@@ -91,9 +92,9 @@ void all_devices_to_all_power(void)
 
 void clear_proc_devices(void)
 {
-	std::vector<class device_consumer *>::iterator it = all_proc_devices.begin();
-	while (it != all_proc_devices.end()) {
-		delete *it;
-		it = all_proc_devices.erase(it);
-	}
+	unsigned int i;
+
+	for (i = 0; i < all_proc_devices.size(); i++)
+		device_pool.put(all_proc_devices[i]);
+	all_proc_devices.clear();
 }
@@ -28,35 +28,73 @@
 #include <stdint.h>
 #include <string.h>
 #include <stdio.h>
+#include <errno.h>
+#include <unordered_set>
 
 #include "timer.h"
 #include "../lib.h"
+#include "../perf/perf_capture.h"
 #include "process.h"
 
 using namespace std;
 
-static bool timer_is_deferred(const char *handler)
+/*
+ * Functions of the deferrable timers in /proc/timer_stats, whose lines
+ * look like
+ *	"   4D,     1 swapper          hrtimer_start_range_ns (tick_sched_timer)"
+ * Read once per interval on the first new timer, and not at all once we
+ * know the kernel does not have the file (it is gone since 4.11).
+ */
+static unordered_set<string> deferred_handlers;
+static bool deferred_handlers_read;
+static bool timer_stats_missing;
+
+static void read_deferred_handlers(void)
 {
 	FILE    *file;
-	bool    ret = false;
 	char    line[4096];
 
-	file = fopen("/proc/timer_stats", "r");	
+	deferred_handlers_read = true;
+	deferred_handlers.clear();
+	/* not part of a capture; the local one says nothing about it */
+	if (timer_stats_missing || replay_active())
+		return;
+
+	file = fopen("/proc/timer_stats", "r");
 	if (!file) {
-		return ret;
+		if (errno == ENOENT)
+			timer_stats_missing = true;
+		return;
 	}
 
-	while (!feof(file)) {
-		if (fgets(line, 4096, file) == NULL)
-			break;
-		if (strstr(line, handler)) {
-			ret = (strstr(line, "D,") != NULL);
-			if (ret == true)
-				break;
+	while (fgets(line, 4096, file) != NULL) {
+		char *start, *end, *word, *last = NULL;
+
+		if (!strstr(line, "D,"))
+			continue;
+
+		/* the callback, in parentheses */
+		start = strrchr(line, '(');
+		end = start ? strchr(start, ')') : NULL;
+		if (start && end) {
+			deferred_handlers.insert(string(start + 1, end - start - 1));
+			*start = 0;
 		}
+
+		/* and the function that armed the timer, the word before it */
+		for (word = strtok(line, " \t\n"); word; word = strtok(NULL, " \t\n"))
+			last = word;
+		if (last)
+			deferred_handlers.insert(last);
 	}
 	fclose(file);
-	return ret;
+}
+
+static bool timer_is_deferred(const char *handler)
+{
+	if (!deferred_handlers_read)
+		read_deferred_handlers();
+	return deferred_handlers.count(handler) > 0;
 }
 
 timer::timer(unsigned long address) : power_consumer()
@@ -68,6 +106,7 @@ timer::timer(unsigned long address) : power_consumer()
 
 
 static map<unsigned long, class timer *> all_timers;
+static consumer_pool<class timer> timer_pool("timer");
 static map<unsigned long, uint64_t> running_since;
 
 void timer::fire(uint64_t time, uint64_t timer_struct)
@@ -136,7 +175,7 @@ class timer * find_create_timer(uint64_t func)
 	if (all_timers.find(func) != all_timers.end())
 		return all_timers[func];
 
-	timer = new class timer(func);
+	timer = new (timer_pool.get()) class timer(func);
 	all_timers[func] = timer;
 	return timer;
 
@@ -144,13 +183,13 @@ class timer * find_create_timer(uint64_t func)
 
 void clear_timers(void)
 {
-	std::map<unsigned long, class timer *>::iterator it = all_timers.begin();
-	while (it != all_timers.end()) {
-		delete it->second;
-		all_timers.erase(it);
-		it = all_timers.begin();
-	}
+	std::map<unsigned long, class timer *>::iterator it;
+
+	for (it = all_timers.begin(); it != all_timers.end(); ++it)
+		timer_pool.put(it->second);
+	all_timers.clear();
 	running_since.clear();
+	deferred_handlers_read = false;
 }
 
 bool timer::is_deferred(void)
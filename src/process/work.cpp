@@ -45,6 +45,7 @@ work::work(unsigned long address) : power_consumer()
 
 
 static map<unsigned long, class work *> all_work;
+static consumer_pool<class work> work_pool("work");
 static map<unsigned long, uint64_t> running_since;
 
 void work::fire(uint64_t time, uint64_t work_struct)
@@ -99,12 +100,11 @@ void all_work_to_all_power(void)
 
 void clear_work(void)
 {
-	std::map<unsigned long, class work *>::iterator it = all_work.begin();
-	while (it != all_work.end()) {
-		delete it->second;
-		all_work.erase(it);
-		it = all_work.begin();
-	}
+	std::map<unsigned long, class work *>::iterator it;
+
+	for (it = all_work.begin(); it != all_work.end(); ++it)
+		work_pool.put(it->second);
+	all_work.clear();
 	running_since.clear();
 }
 
@@ -124,7 +124,7 @@ class work * find_create_work(uint64_t func)
 	if (all_work.find(func) != all_work.end())
 		return all_work[func];
 
-	work = new class work(func);
+	work = new (work_pool.get()) class work(func);
 	all_work[func] = work;
 	return work;
 }